@@ -3,43 +3,225 @@
 
 #include "../mstimer.h"
 
-//#define OVERSAMPLE_RATE 14
-#define OVERSAMPLE_RATE 16
+#include "adc.h"
+#include "cic.h"
+#include "handoff.h"
+#include "output.h"
 
-uint16_t _value = 0;
-char     AdcValueIsValid = 0;
+/*
+Conversions are started by the CCP2 special event trigger so the sample rate is fixed and does not depend on interrupt latency.
+Timer 3 runs at Fosc/4/8 = 8MHz/4/8 = 250kHz so 250 counts between battery samples gives 1000 samples per second.
 
-uint16_t AdcGetValue()
+Each 12 bit battery sample is fed into two cascaded second order CIC decimators:
+  fast: 12 bit sample x 2^(2 x 8) ==> 28 bit value at 1000Hz / 256 = 3.9Hz  - used for control
+  slow: 20 bit fast   x 2^(2 x n) ==> 24 to 32 bit value at 3.9Hz / 2^n     - used for calibration
+Both are decimated to the same 16 bit scale.
+
+The slow depth n is set at runtime: shallow while the battery is working and deep while it is at rest.
+A change is applied by the interrupt at the next fast value and restarts the slow decimator, so the
+previous value is held until the new depth has produced one. Each slow value carries its effective resolution.
+
+Scanning
+========
+Any other channels in the table below are scanned round robin between battery samples. The trigger then runs
+twice as fast so the battery still gets 1000 samples per second and the other channels share the other 1000.
+The interrupt selects the next channel as soon as it has the result so the next conversion has the whole
+trigger period to acquire. Each other channel is summed over 2^oversample samples and decimated to a
+signed value of ADC_CHANNEL_BITS; a channel is valid once it has produced its first value.
+To add a measurement add a line to the table and its slot to adc.h.
+
+Trip limits
+===========
+Each raw battery sample is compared with high and low limits held in raw 12 bit counts so the check costs two compares.
+ADC_TRIP_SAMPLES consecutive samples beyond a limit trip the output straight from the interrupt, so the latency is a
+few milliseconds rather than a main loop pass on a value averaged over seconds.
+The limits are double buffered: the main loop fills the buffer the interrupt is not using and then switches the index.
+*/
+#define CHSN_AVSS 0
+#define CHSN_AN(n) ((n) + 1)
+
+struct channel
+{
+    uint8_t positive;       //CHS  value: AN number
+    uint8_t negative;       //CHSN value: CHSN_AVSS or CHSN_AN(n)
+    uint8_t log2Oversample; //Not used by the battery channel which has the CIC decimators
+};
+static const struct channel _channels[ADC_CHANNEL_COUNT] =
+{
+  //  +ve  -ve         oversample
+    {   1, CHSN_AN(2),  0 }, //ADC_CHANNEL_BATTERY
+#if ADC_CHANNEL_COUNT > 1
+    {   9, CHSN_AVSS ,  6 }, //Backup thermistor
+#endif
+  //{  10, CHSN_AN(2),  6 }, //Second battery tap
+};
+
+#if ADC_CHANNEL_COUNT > 1
+#define TRIGGER_COUNT 125
+#else
+#define TRIGGER_COUNT 250
+#endif
+
+static struct Cic _fastCic;
+static struct Cic _slowCic;
+
+struct values
+{
+    struct AdcBattery battery;
+    int16_t  channelValues[ADC_CHANNEL_COUNT];
+};
+static volatile struct values _values;
+static volatile uint8_t _valuesSequence = 0; //Incremented by the interrupt after each update of _values
+static volatile uint8_t _validChannels  = 0; //One bit per channel
+static uint8_t  _slowLog2Rate       = ADC_SLOW_LOG2_RATE_SHALLOW;
+static volatile uint8_t _slowLog2RateWanted = ADC_SLOW_LOG2_RATE_SHALLOW;
+static volatile uint16_t _tripLimits[2][2]; //[buffer][0 = high, 1 = low]
+static volatile uint8_t  _tripLimitsIndex = 0; //Buffer in use by the interrupt
+static volatile uint32_t _tripLatencyMs   = 0;
+static volatile uint8_t  _tripSequence    = 0; //Incremented by the interrupt after each update of _tripLatencyMs
+char     AdcFastValueIsValid = 0;
+char     AdcSlowValueIsValid = 0;
+
+void AdcGetBattery(struct AdcBattery* pBattery)
+{
+    HandoffRead(&_valuesSequence, &_values.battery, pBattery, sizeof(struct AdcBattery));
+}
+void AdcSetSlowLog2Rate(uint8_t v)
 {
-    uint16_t value;
-    di();
-        value = _value;
-    ei();
+    _slowLog2RateWanted = v; //Single byte so the interrupt always sees a whole value
+}
+int16_t AdcGetChannelValue(uint8_t channel)
+{
+    int16_t value;
+    HandoffRead(&_valuesSequence, &_values.channelValues[channel], &value, sizeof(value));
+    return value;
+}
+void AdcSetTripLimits(uint16_t high, uint16_t low)
+{
+    uint8_t next = _tripLimitsIndex ^ 1;
+    _tripLimits[next][0] = high;
+    _tripLimits[next][1] = low;
+    _tripLimitsIndex = next; //Single byte so the interrupt sees either the old or the new pair
+}
+uint32_t AdcGetTripLatencyMs()
+{
+    uint32_t value;
+    HandoffRead(&_tripSequence, &_tripLatencyMs, &value, sizeof(value));
     return value;
 }
 
+char AdcChannelIsValid(uint8_t channel)
+{
+    return (_validChannels >> channel) & 1;
+}
+
 char AdcHadInterrupt()
 {
     return ADIF;
 }
-void AdcHandleInterrupt()
+static void checkTripLimits(uint16_t value)
+{
+    static uint8_t  overCount  = 0;
+    static uint8_t  underCount = 0;
+    static uint32_t msFirstBeyond = 0;
+    
+    uint8_t index = _tripLimitsIndex;
+    if (value > _tripLimits[index][0]) { if (overCount  < ADC_TRIP_SAMPLES + 1) overCount++;  } else overCount  = 0;
+    if (value < _tripLimits[index][1]) { if (underCount < ADC_TRIP_SAMPLES + 1) underCount++; } else underCount = 0;
+    
+    if (overCount == 1 || underCount == 1) msFirstBeyond = MsTimerCount;
+    char fault = 0;
+    if (overCount  == ADC_TRIP_SAMPLES) fault = OUTPUT_FAULT_OVER_VOLTAGE;
+    if (underCount == ADC_TRIP_SAMPLES) fault = OUTPUT_FAULT_UNDER_VOLTAGE;
+    if (fault)
+    {
+        OutputHandleVoltageTrip(fault);
+        _tripLatencyMs = MsTimerCount - msFirstBeyond;
+        _tripSequence++;
+    }
+}
+static void addBatterySample(uint16_t value)
 {
-    static uint32_t total = 0;
-    static uint32_t count = 0;
+    checkTripLimits(value);
     
+    uint32_t fast;
+    uint32_t slow;
+    if (CicAdd(&_fastCic, value, ADC_FAST_LOG2_RATE, &fast))
+    {
+        _values.battery.fastValue = (uint16_t)(fast >> (12 + 2 * ADC_FAST_LOG2_RATE - 16)); //Decimate to 16 bits
+        _values.battery.fastCount++;
+        AdcFastValueIsValid = 1;
+        
+        if (_slowLog2Rate != _slowLog2RateWanted)
+        {
+            _slowLog2Rate = _slowLog2RateWanted;
+            CicReset(&_slowCic);
+        }
+        if (CicAdd(&_slowCic, fast >> (2 * ADC_FAST_LOG2_RATE - 8), _slowLog2Rate, &slow)) //Pass on 8 extra bits
+        {
+            _values.battery.slowValue = (uint16_t)(slow >> (20 + 2 * _slowLog2Rate - 16)); //Decimate to 16 bits
+            _values.battery.slowBits  = ADC_SLOW_BITS(_slowLog2Rate);
+            _values.battery.slowCount++;
+            AdcSlowValueIsValid = 1;
+        }
+        _valuesSequence++;
+    }
+}
+#if ADC_CHANNEL_COUNT > 1
+static int32_t  _channelTotals[ADC_CHANNEL_COUNT];
+static uint16_t _channelCounts[ADC_CHANNEL_COUNT];
+static void addChannelSample(uint8_t channel, int16_t value) //Differential results are signed
+{
+    _channelTotals[channel] += value;
+    _channelCounts[channel]++;
+    uint8_t log2Oversample = _channels[channel].log2Oversample;
+    if (_channelCounts[channel] < (1U << log2Oversample)) return;
+    
+    int32_t total = _channelTotals[channel]; //Will contain 12 bit value * 2^oversample
+    if (log2Oversample >= ADC_CHANNEL_BITS - 12) total >>= log2Oversample - (ADC_CHANNEL_BITS - 12);
+    else                                         total <<= (ADC_CHANNEL_BITS - 12) - log2Oversample;
+    _values.channelValues[channel] = (int16_t)total;
+    _valuesSequence++;
+    _validChannels |= 1 << channel;
+    
+    _channelTotals[channel] = 0;
+    _channelCounts[channel] = 0;
+}
+#endif
+void AdcHandleInterrupt()
+{
     uint16_t value = ((uint16_t)ADRESH << 8) + ADRESL;
-    total += value;    //Will contain 12 bit value * OVERSAMPLE_RATE ==> 28 bit value
-    count++;
-    if (count >= (1UL << OVERSAMPLE_RATE))
+    
+#if ADC_CHANNEL_COUNT > 1
+    static uint8_t channel  = ADC_CHANNEL_BATTERY; //Channel of the conversion just completed
+    static uint8_t nextScan = 1;
+    uint8_t thisChannel = channel;
+    if (thisChannel == ADC_CHANNEL_BATTERY)
+    {
+        channel = nextScan;
+        nextScan++;
+        if (nextScan >= ADC_CHANNEL_COUNT) nextScan = 1;
+    }
+    else
     {
-        count = 0;
-        _value = (uint16_t)(total >> (12 + OVERSAMPLE_RATE - 16)); //Decimate to 16 bits
-        AdcValueIsValid = 1;
-        total = 0;
+        channel = ADC_CHANNEL_BATTERY;
     }
-    ADCON0bits.GO = 1; //Start conversion
+    ADCON0bits.CHS  = _channels[channel].positive;
+    ADCON1bits.CHSN = _channels[channel].negative;
+    
+    if (thisChannel == ADC_CHANNEL_BATTERY) addBatterySample(value);
+    else                                    addChannelSample(thisChannel, (int16_t)value);
+#else
+    addBatterySample(value);
+#endif
+    
     ADIF = 0;          //Clear the interrupt bit
 }
+static void setAnalogue(uint8_t an)
+{
+    if (an < 8) ANCON0 |= 1 << an;
+    else        ANCON1 |= 1 << (an - 8);
+}
 void AdcInit(void)
 {
 	ADCON2bits.ADFM  = 1; // Right justified into lsb
@@ -49,22 +231,35 @@ void AdcInit(void)
 	
 	ADCON1bits.VCFG  = 3; //Vr+ uses internal 4.096 reference
 	ADCON1bits.VNCFG = 0; //Vr- uses AVss
-	ADCON1bits.CHSN  = 3; //-ve input <-- AN2
+	ADCON1bits.TRIGSEL = 3; //Special trigger from CCP2
 	
-	ANCON0            = 0;
-	ANCON0bits.ANSEL4 = 0;//AN4 configured as digital
-	ANCON0bits.ANSEL3 = 0;//AN3 configured as digital
-	ANCON0bits.ANSEL2 = 1;//AN2 configured as analogue -> -ve input
-	ANCON0bits.ANSEL1 = 1;//AN1 configured as analogue -> +ve input
-	ANCON0bits.ANSEL0 = 0;//AN0 configured as digital
+	ANCON0            = 0;//AN0-7  configured as digital
     ANCON1            = 0;//AN8-14 configured as digital
+    for (uint8_t i = 0; i < ADC_CHANNEL_COUNT; i++) //Then configure the pins in the channel table as analogue
+    {
+        setAnalogue(_channels[i].positive);
+        if (_channels[i].negative != CHSN_AVSS) setAnalogue(_channels[i].negative - 1);
+    }
 			
-    ADCON0bits.CHS    = 1; //+ve input <-- AN1
+    ADCON0bits.CHS    = _channels[ADC_CHANNEL_BATTERY].positive; //+ve input <-- AN1
+	ADCON1bits.CHSN   = _channels[ADC_CHANNEL_BATTERY].negative; //-ve input <-- AN2
     
 	ADCON0bits.ADON  = 1; //Enable adc
     
+    CicReset(&_fastCic);
+    CicReset(&_slowCic);
+    
+    _tripLimits[0][0] = 0xFFFF; //No limits until they are set
+    _tripLimits[0][1] = 0;
+    
     ADIF = 0;             //Clear the interrupt bit
     ADIE = 1;             //Enable interrupts
-    ADCON0bits.GO = 1;    //Start conversion
     
+    T3CONbits.TMR3CS   = 0;                    //Timer 3 clock is Fosc/4
+    T3CONbits.T3CKPS   = 3;                    //Prescale 1:8
+    CCPTMRSbits.C2TSEL = 1;                    //Associate CCP2 module with Timer 3
+    CCPR2H             = TRIGGER_COUNT >> 8;
+    CCPR2L             = TRIGGER_COUNT & 0xFF;
+    CCP2CONbits.CCP2M  = 0xB;                  //Compare mode: special event trigger resets Timer 3 and starts a conversion
+    T3CONbits.TMR3ON   = 1;                    //Start the sample clock
 }
\ No newline at end of file
@@ -4,9 +4,41 @@ extern char AdcHadInterrupt(void);
 extern void AdcHandleInterrupt(void);
 
 
-extern uint16_t AdcGetValue(void);
-extern char AdcValueIsValid;
+struct AdcBattery
+{
+    uint16_t fastValue;
+    uint8_t  fastCount; //Incremented with each new fast value
+    uint16_t slowValue;
+    uint8_t  slowBits;  //Effective resolution of the slow value
+    uint8_t  slowCount; //Incremented with each new slow value
+};
+extern void     AdcGetBattery(struct AdcBattery* pBattery);
+extern void     AdcSetSlowLog2Rate(uint8_t log2Rate);
+extern char AdcFastValueIsValid;
+extern char AdcSlowValueIsValid;
+
+extern void     AdcSetTripLimits(uint16_t high, uint16_t low); //Raw 12 bit counts
+extern uint32_t AdcGetTripLatencyMs(void);
+
+extern int16_t  AdcGetChannelValue(uint8_t channel);
+extern char     AdcChannelIsValid (uint8_t channel);
 
 #define ADC_VREF_MV 4096
 #define ADC_VREF 4.096f
 #define ADC_BITS 16
+
+#define ADC_SAMPLE_RATE_HZ 1000
+#define ADC_FAST_LOG2_RATE    8 //1000Hz / 256 ==> 3.9Hz
+#define ADC_SLOW_LOG2_RATE_SHALLOW 2 //3.9Hz /  4 ==> 1s  - while the current is changing
+#define ADC_SLOW_LOG2_RATE_DEEP    6 //3.9Hz / 64 ==> 16s - while at rest
+
+#define ADC_SLOW_BITS(log2Rate) (12 + (ADC_FAST_LOG2_RATE + (log2Rate)) / 2) //Each 4x oversample adds one bit: 17 shallow; 19 deep
+
+#define ADC_TRIP_SAMPLES 4 //Consecutive raw samples beyond a limit before the output is tripped ==> 4ms
+
+#define ADC_CHANNEL_BITS 15 //Scanned channels are signed: +/- Vref is +/- 2^15
+
+#define ADC_CHANNEL_BATTERY 0
+#ifndef ADC_CHANNEL_COUNT
+#define ADC_CHANNEL_COUNT   1 //Must match the table in adc.c; up to 8. The host harness builds it with 2 to compile the scan
+#endif
\ No newline at end of file
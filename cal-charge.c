@@ -1,43 +1,48 @@
 #include <stdint.h>
 #include <limits.h>
 
-#include "../eeprom.h"
-
 #include "count.h"
 #include "voltage.h"
+#include "adc.h"
 #include "rest.h"
 #include "eeprom-this.h"
 #include "curve.h"
+#include "ocv.h"
+#include "cal-pulse.h"
+#include "soh.h"
+
+#define MIN_CONFIDENCE 40 //2mV per % so a 1mV error is worth 0.5%
 
 static int32_t _differenceMilliAmpSeconds = 0;
-static int16_t _pulseAdjustMilliAmpSeconds = 0;
 static char    _isActive = 0;
 
 int32_t CalChargeGetDifferenceMas (         ) { return _differenceMilliAmpSeconds; }
-int16_t CalChargeGetPulseAdjustMas(         ) { return _pulseAdjustMilliAmpSeconds; }
-void    CalChargeSetPulseAdjustMas(int16_t v) {        _pulseAdjustMilliAmpSeconds = v; EepromSaveS16(EEPROM_CAL_PULSE_ADJUST_MAS_S16, v); }
 char    CalChargeGetIsActive      (         ) { return _isActive; }
 
 void CalChargeInit()
 {
-     _differenceMilliAmpSeconds = (int32_t)EepromReadS16(EEPROM_CAL_DIFFERENCE_MAS_S16) << 16;
-    _pulseAdjustMilliAmpSeconds =          EepromReadS16(EEPROM_CAL_PULSE_ADJUST_MAS_S16);
+     _differenceMilliAmpSeconds = (int32_t)EepromThisReadS16(EEPROM_CAL_DIFFERENCE_MAS_S16) << 16;
 }
 void CalChargeMain()
 {
     static char _oneShot = 1; //Init as true so that don't reactivate on reset
     _isActive = 0;
     
-    char stable = RestGetVoltageIsStable();
+    char stable      = RestGetVoltageIsStable();
+    char compensated = !stable && OcvGetIsConfident(); //Use the IR compensated voltage while a small steady current flows
     
-    if (!stable   ) { _oneShot = 0; return; }
+    if (!stable && !compensated) { _oneShot = 0; return; }
     
-    int16_t batteryMv = VoltageGetAsMv();
+    char resolved = VoltageGetResolutionBits() >= ADC_SLOW_BITS(ADC_SLOW_LOG2_RATE_DEEP);
+    if (!resolved ) { _oneShot = 0; return; }
+    
+    int16_t batteryMv = compensated ? OcvGetMv() : RestGetOcvMv();
     if (!batteryMv) { _oneShot = 0; return; }
     
     uint32_t calculatedAs = 0;
-    char outOfRange = CurveGetInflexionAsFromMv(batteryMv / 4, &calculatedAs);
-    if (outOfRange) { _oneShot = 0; return; }
+    uint8_t  confidence   = 0;
+    char outOfRange = CurveGetAsFromMv(batteryMv / 4, &calculatedAs, &confidence);
+    if (outOfRange || confidence < MIN_CONFIDENCE) { _oneShot = 0; return; } //Not on a part of the curve steep enough to trust
     
     _isActive = 1;
     
@@ -48,23 +53,20 @@ void CalChargeMain()
     {
         //Save difference
         _differenceMilliAmpSeconds = (int32_t)(calculatedMilliAmpSeconds - countedMilliAmpSeconds);
-        EepromSaveS16(EEPROM_CAL_DIFFERENCE_MAS_S16, (int16_t)(_differenceMilliAmpSeconds >> 16));
+        EepromThisSaveS16(EEPROM_CAL_DIFFERENCE_MAS_S16, (int16_t)(_differenceMilliAmpSeconds >> 16));
+        
+        //Learn the pulse adjustment for each polarity
+        CalPulseAddCalibration(_differenceMilliAmpSeconds, CountGetPosPulses(), CountGetNegPulses());
         
-        //Calculate new pulse adjust
-        int32_t pulseCount = CountGetPosPulses() + CountGetNegPulses();
-        if (pulseCount) //Don't divide by zero - undefined behaviour!
-        {
-            int32_t newPulseAdjustMilliAmpSeconds = _differenceMilliAmpSeconds / pulseCount;
-            if (newPulseAdjustMilliAmpSeconds > INT_MAX) newPulseAdjustMilliAmpSeconds = INT_MAX;
-            if (newPulseAdjustMilliAmpSeconds < INT_MIN) newPulseAdjustMilliAmpSeconds = INT_MIN;
-            CalChargeSetPulseAdjustMas((int16_t)newPulseAdjustMilliAmpSeconds);
-        }
+        //Estimate the real capacity
+        SohAddCalibration(calculatedAs, countedMilliAmpSeconds / 1000);
         
         //Only do this once per cycle
         _oneShot = 1;
     }
     
     CountSetMilliAmpSeconds(calculatedMilliAmpSeconds);
+    SohSetBaselineAs(calculatedAs);
     CountResPosPulses();
     CountResNegPulses();
 }
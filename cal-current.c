@@ -5,30 +5,86 @@
 #include "pulse.h"
 #include "count.h"
 
-#define ZERO_CURRENT_REPEAT_TIME 1UL*60*60*1000
+/*
+Zero current offset
+===================
+While the current is stable any current seen is taken to be an offset, so the offset is set to cancel it.
+The pulses are too coarse to measure a few mA directly: at 10mA there is one every 100 minutes. Instead the
+net pulse count is taken over the whole stable window: n pulses in t seconds means the current lies between
+(n - 1) and (n + 1) pulses in t, and that range narrows as the window grows.
+Every UPDATE_TIME the offset is moved to the nearest point of the range, so it jumps straight to a wrong
+offset however far out it was, and then refines. Each move is limited to MAX_STEP_MA.
+The offset is trimmed in ram and only saved when it has moved more than DEADBAND_MA from the saved value,
+or when the window ends with it different.
+*/
+#define MIN_WINDOW_TIME 10UL*60*1000
+#define UPDATE_TIME      1UL*60*1000
+#define MAX_STEP_MA     50
+#define DEADBAND_MA      2
+#define MAX_OFFSET_MA 1000
 static char    _isActive = 0;
+static int16_t _savedOffsetMa = 0;
 
 char    CalCurrentGetIsActive      (         ) { return _isActive; }
 
-void CalCurrentInit()
+static void save(int16_t offsetMa)
+{
+    CountSetCurrentOffsetMa(offsetMa);
+    _savedOffsetMa = offsetMa;
+}
+static int16_t limit(int32_t v, int32_t min, int32_t max)
 {
+    if (v < min) v = min;
+    if (v > max) v = max;
+    return (int16_t)v;
+}
+static void update(int32_t netPulses, uint32_t msWindow)
+{
+    int32_t  seconds = (int32_t)(msWindow / 1000);
+    int32_t  lowMa   = (netPulses - 1) * PULSE_MA_SECONDS_PER_PULSE / seconds; //Fits while the window has fewer than 34000 pulses
+    int32_t  highMa  = (netPulses + 1) * PULSE_MA_SECONDS_PER_PULSE / seconds;
+    
+    int16_t offsetMa = CountGetCurrentOffsetMa();
+    int32_t currentMa = -offsetMa;                  //The current the offset currently cancels
+    int32_t targetMa = currentMa;
+    if (targetMa < lowMa ) targetMa = lowMa;
+    if (targetMa > highMa) targetMa = highMa;
+    int32_t step = limit(targetMa - currentMa, -MAX_STEP_MA, MAX_STEP_MA);
+    int16_t newOffsetMa = limit(offsetMa - step, -MAX_OFFSET_MA, MAX_OFFSET_MA);
+    if (newOffsetMa == offsetMa) return;
+    
+    int16_t moved = newOffsetMa - _savedOffsetMa;
+    if (moved > DEADBAND_MA || moved < -DEADBAND_MA) save(newOffsetMa);
+    else                                             CountTrimCurrentOffsetMa(newOffsetMa);
+}
 
+void CalCurrentInit()
+{
+    _savedOffsetMa = CountGetCurrentOffsetMa();
 }
 void CalCurrentMain()
 {
-    _isActive = 0;
+    static uint32_t msWindowStart = 0;
+    static int32_t  netCountStart = 0;
+    static uint32_t msTimerUpdate = 0;
+    
     char stable = RestGetCurrentIsStable();
-    static uint32_t _msTimerRepeat = 0;
     if (!stable)
     {
-        _msTimerRepeat = MsTimerCount - ZERO_CURRENT_REPEAT_TIME; //This allows it to start immediately when next run
+        if (_isActive && CountGetCurrentOffsetMa() != _savedOffsetMa) save(CountGetCurrentOffsetMa());
+        _isActive = 0;
         return;
     }
-    _isActive = 1;
-    if (!MsTimerRepetitive(&_msTimerRepeat,   ZERO_CURRENT_REPEAT_TIME)) return;
+    if (!_isActive)
+    {
+        _isActive = 1;
+        msWindowStart = MsTimerCount;
+        netCountStart = PulseGetNetCount();
+        msTimerUpdate = MsTimerCount;
+    }
+    uint32_t msWindow = MsTimerCount - msWindowStart;
+    if (msWindow < MIN_WINDOW_TIME) return;
+    if (!MsTimerRepetitive(&msTimerUpdate, UPDATE_TIME)) return;
     
-    int32_t currentMa = PulseGetCurrentMa();       //Say  12mA
-    int16_t  offsetMa = CountGetCurrentOffsetMa(); //Say -11mA
-    if (currentMa + offsetMa > 0) CountSetCurrentOffsetMa(offsetMa - 1); //Set new current offset to be -12mA
-    if (currentMa + offsetMa < 0) CountSetCurrentOffsetMa(offsetMa + 1);
+    update(PulseGetNetCount() - netCountStart, msWindow);
 }
\ No newline at end of file
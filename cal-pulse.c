@@ -1 +1,294 @@
+#include <stdint.h>
 
+#include "../mstimer.h"
+
+#include "eeprom-this.h"
+#include "cal-pulse.h"
+#include "count.h"
+#include "pulse.h"
+#include "temperature.h"
+
+/*
+Polarity
+========
+The coulomb counter is not equally accurate in both directions so each direction has its own adjustment to the mAs
+per pulse. At each calibration the difference between the calculated and the counted charge is:
+    difference = (posError - posAdjust) x posPulses - (negError - negAdjust) x negPulses
+Adding back the adjustments in use at the time gives an equation in the errors alone which stays true whatever the
+adjustments are later changed to.
+
+Recursive least squares
+=======================
+The errors are estimated by weighted recursive least squares. The state, the two errors and their 2 x 2 covariance P,
+is kept in the eeprom and each calibration updates it:
+    q = P x    s = variance + xT q    errors += q (d - xT errors) / s    P -= q qT / s
+where x = (posPulses, -negPulses) and d is the difference with the adjustments added back. The variance of d is:
+    - the voltage calibration is good to about VOLTAGE_SIGMA_PERMILLE of the capacity, worse away from 25 degrees;
+    - an offset of DRIFT_MA in the count grows with the time between the calibrations.
+It starts at the adjustments in use with a sigma of PRIOR_SIGMA_MAS so a single calibration cannot push them far.
+Before each update P is divided by a forgetting factor of 7/8 so each older calibration counts for 7/8 of the one after
+it and, as with a history of about the last eight, the errors can follow the counter as it ages. That stops once P would
+be less certain than the prior.
+A calibration whose d is more than GATE_SIGMAS sigma of s from the prediction is taken to be a bad reading and ignored.
+The adjustments then move towards the estimate by at most MAX_STEP_MAS per calibration.
+
+Fixed point
+===========
+Everything is 32 bit. The equation is divided through by the total pulses, n, so x becomes the share of each direction
+in 12 bit fixed decimal places, adding up to 4096 in magnitude, d becomes mAs per pulse and its sigma is divided by n.
+The errors are held in mAs with 4 bit fixed decimal places and P in mAs^2 so the variances need no conversion.
+Products with x are split at the 12th bit so they cannot overflow. The two divisions by s are done by mulDiv which
+drops the low bits of its operands, keeping at least 16 significant bits, until the product fits.
+
+Saving
+======
+The state is saved in two slots of SLOT_SIZE bytes, the five values, a crc and a sequence, used in turn. As in the journal
+the sequence is written last: the write behind writes the lowest address first so it is the slot's highest byte. Until
+then the torn slot keeps the sequence from two saves ago, so even if it passes its crc by chance the other slot, the
+state before, is newer and is used.
+*/
+#define MIN_PULSES          100     //Fewer than this says little about either direction
+#define VOLTAGE_SIGMA_PERMILLE 5    //0.5%
+#define DRIFT_MA             20
+#define MAX_HOURS         20000     //Keeps DRIFT_MA x 3600 x hours within 31 bits
+#define MAX_SIGMA_MAS     30000     //Per pulse; the sum of two squares must fit in 31 bits
+#define PRIOR_SIGMA_MAS    3000
+#define PRIOR_VARIANCE (PRIOR_SIGMA_MAS * (int32_t)PRIOR_SIGMA_MAS)
+#define FORGET_DIVISOR        7     //P x 8 / 7 each calibration
+#define GATE_SIGMAS           5
+#define MAX_STEP_MAS        500
+#define MAX_ADJUST_MAS (PULSE_MA_SECONDS_PER_PULSE / 10)
+#define X_SHIFT              12
+#define X_ONE (1 << X_SHIFT)
+#define ERROR_SHIFT           4
+#define STATE_SIZE           20
+#define SLOT_SIZE (STATE_SIZE + 2)
+
+static int16_t  _posAdjustMas   = 0;
+static int16_t  _negAdjustMas   = 0;
+static uint32_t _posCharge      = 0;
+static uint32_t _negCharge      = 0;
+static int32_t  _posError4bfdp  = 0;
+static int32_t  _negError4bfdp  = 0;
+static int32_t  _p00            = PRIOR_VARIANCE; //mAs^2
+static int32_t  _p01            = 0;
+static int32_t  _p11            = PRIOR_VARIANCE;
+static uint8_t  _slot          = 0;
+static uint8_t  _sequence       = 0;
+static uint32_t _msLastCalibration = 0;
+
+static uint32_t makeCharge(int16_t adjustMas)
+{
+    int32_t mas = (int32_t)PULSE_MA_SECONDS_PER_PULSE + adjustMas;
+    return (uint32_t)((mas * COUNT_UNITS_PER_AS + 500) / 1000); //Only when an adjustment changes
+}
+int16_t  CalPulseGetPosAdjustMas() { return _posAdjustMas; } void CalPulseSetPosAdjustMas(int16_t v) { _posAdjustMas = v; _posCharge = makeCharge(v); EepromThisSaveS16(EEPROM_CAL_PULSE_POS_ADJUST_MAS_S16, v); }
+int16_t  CalPulseGetNegAdjustMas() { return _negAdjustMas; } void CalPulseSetNegAdjustMas(int16_t v) { _negAdjustMas = v; _negCharge = makeCharge(v); EepromThisSaveS16(EEPROM_CAL_PULSE_NEG_ADJUST_MAS_S16, v); }
+uint32_t CalPulseGetPosCharge   () { return _posCharge;    }
+uint32_t CalPulseGetNegCharge   () { return _negCharge;    }
+uint32_t CalPulseGetPosVariance () { return (uint32_t)_p00; }
+uint32_t CalPulseGetNegVariance () { return (uint32_t)_p11; }
+
+static int32_t absolute(int32_t v) { return v < 0 ? -v : v; }
+
+static int32_t mulX(int32_t a, int16_t x) //a x x / X_ONE
+{
+    return (a >> X_SHIFT) * x + (((a & (X_ONE - 1)) * x + (X_ONE >> 1)) >> X_SHIFT);
+}
+static int32_t mulDiv(int32_t a, int32_t b, int32_t c) //a x b / c with c > 0
+{
+    char     negative = (a < 0) != (b < 0);
+    uint32_t ua = (uint32_t)absolute(a);
+    uint32_t ub = (uint32_t)absolute(b);
+    uint32_t uc = (uint32_t)c;
+    uint8_t  left = 0;
+    while (ua > 0xFFFF || ub > 0xFFFF)
+    {
+        if (ua > ub) ua >>= 1;
+        else         ub >>= 1;
+        if (uc > 0xFFFF) uc >>= 1;
+        else             left++;
+    }
+    uint32_t result = (ua * ub + (uc >> 1)) / uc;
+    while (left--)
+    {
+        if (result > 0x3FFFFFFF) { result = 0x7FFFFFFF; break; }
+        result <<= 1;
+    }
+    return negative ? -(int32_t)result : (int32_t)result;
+}
+
+static int32_t perPulseSquared(int32_t sigmaMas, int32_t pulses)
+{
+    int32_t perPulse8bfdp = mulDiv(sigmaMas, 256, pulses); //Keeps the fraction which would otherwise bias the square low
+    if (perPulse8bfdp > (int32_t)MAX_SIGMA_MAS << 8) perPulse8bfdp = (int32_t)MAX_SIGMA_MAS << 8;
+    return mulDiv(perPulse8bfdp, perPulse8bfdp, 65536);
+}
+static int32_t getVariance(int32_t pulses) //Of d in mAs per pulse
+{
+    int32_t sigmaV = (int32_t)CountGetCapacityAh() * 3600 * VOLTAGE_SIGMA_PERMILLE; //mAs
+    int16_t dT = TemperatureIsValid ? TemperatureGetAs8bfdp() - (25 << 8) : 0;
+    sigmaV += (sigmaV >> 8) * absolute(dT) / 10;                                      //Doubles at 15 or 35 degrees
+    uint32_t hours = (MsTimerCount - _msLastCalibration) / 3600000;
+    if (hours > MAX_HOURS) hours = MAX_HOURS;
+    int32_t sigmaT = (int32_t)DRIFT_MA * 3600 * (int32_t)hours;                       //mAs
+    return perPulseSquared(sigmaV, pulses) + perPulseSquared(sigmaT, pulses);
+}
+static char update(int32_t differenceMas, uint16_t posPulses, uint16_t negPulses) //Returns 0 if it was rejected
+{
+    int32_t  n  = (int32_t)posPulses + negPulses;
+    int16_t  x0 =  (int16_t)(((uint32_t)posPulses << X_SHIFT) / n);
+    int16_t  x1 = -(int16_t)(X_ONE - x0);
+    int32_t  d  = differenceMas / n * (1 << ERROR_SHIFT) + differenceMas % n * (1 << ERROR_SHIFT) / n;
+    
+    int32_t p00 = _p00 + _p00 / FORGET_DIVISOR;
+    int32_t p01 = _p01 + _p01 / FORGET_DIVISOR;
+    int32_t p11 = _p11 + _p11 / FORGET_DIVISOR;
+    if (p00 > PRIOR_VARIANCE || p11 > PRIOR_VARIANCE) //Forgetting no more than the prior
+    {
+        p00 = _p00;
+        p01 = _p01;
+        p11 = _p11;
+    }
+    
+    int32_t q0 = mulX(p00, x0) + mulX(p01, x1);
+    int32_t q1 = mulX(p01, x0) + mulX(p11, x1);
+    int32_t xPx = mulX(q0, x0) + mulX(q1, x1);
+    if (xPx < 0) xPx = 0;
+    int32_t s = getVariance(n) + xPx;
+    if (s < 1) s = 1;
+    
+    int32_t innovation = d - mulX(_posError4bfdp, x0) - mulX(_negError4bfdp, x1);
+    int32_t innovationMas = absolute(innovation) >> ERROR_SHIFT;
+    if (innovationMas > MAX_SIGMA_MAS * 2 || (uint32_t)innovationMas * innovationMas / (GATE_SIGMAS * GATE_SIGMAS) > (uint32_t)s) return 0;
+    
+    _p00 = p00;
+    _p01 = p01;
+    _p11 = p11;
+    _posError4bfdp += mulDiv(q0, innovation, s);
+    _negError4bfdp += mulDiv(q1, innovation, s);
+    _p00 -= mulDiv(q0, q0, s);
+    _p01 -= mulDiv(q0, q1, s);
+    _p11 -= mulDiv(q1, q1, s);
+    if (_p00 < 1) _p00 = 1; //Rounding could otherwise take them to zero
+    if (_p11 < 1) _p11 = 1;
+    return 1;
+}
+
+static uint16_t slotAddress(uint8_t slot) { return EEPROM_CAL_PULSE_STATE + (uint16_t)slot * SLOT_SIZE; }
+static uint8_t addCrc(uint8_t crc, uint8_t byte) //CRC-8 polynomial 0x07
+{
+    crc ^= byte;
+    for (uint8_t i = 0; i < 8; i++) crc = crc & 0x80 ? (uint8_t)(crc << 1) ^ 0x07 : (uint8_t)(crc << 1);
+    return crc;
+}
+static uint8_t makeCrc(uint16_t address, uint8_t sequence) //Over the state and the sequence
+{
+    uint8_t crc = 0xFF;
+    for (uint8_t i = 0; i < STATE_SIZE; i++) crc = addCrc(crc, EepromThisReadU8(address + i));
+    return addCrc(crc, sequence);
+}
+static void saveS32(uint16_t address, int32_t value)
+{
+    EepromThisSaveU16(address + 0, (uint16_t)((uint32_t)value >> 16));
+    EepromThisSaveU16(address + 2, (uint16_t)           value       );
+}
+static int32_t readS32(uint16_t address)
+{
+    return (int32_t)(((uint32_t)EepromThisReadU16(address + 0) << 16) | EepromThisReadU16(address + 2));
+}
+static void saveState()
+{
+    _slot = !_slot;
+    _sequence++;
+    uint16_t address = slotAddress(_slot);
+    saveS32(address +  0, _posError4bfdp);
+    saveS32(address +  4, _negError4bfdp);
+    saveS32(address +  8, _p00);
+    saveS32(address + 12, _p01);
+    saveS32(address + 16, _p11);
+    EepromThisSaveU8(address + STATE_SIZE    , makeCrc(address, _sequence)); //Reads come from the ram shadow so see the new state
+    EepromThisSaveU8(address + STATE_SIZE + 1, _sequence);                   //Highest address so written last
+}
+static char slotIsValid(uint8_t slot)
+{
+    uint16_t address = slotAddress(slot);
+    return makeCrc(address, EepromThisReadU8(address + STATE_SIZE + 1)) == EepromThisReadU8(address + STATE_SIZE);
+}
+static void readState()
+{
+    char valid0 = slotIsValid(0);
+    char valid1 = slotIsValid(1);
+    if (!valid0 && !valid1) { _slot = 1; return; } //Uninitialised eeprom; the first save goes to slot 0
+    uint8_t sequence0 = EepromThisReadU8(slotAddress(0) + STATE_SIZE + 1);
+    uint8_t sequence1 = EepromThisReadU8(slotAddress(1) + STATE_SIZE + 1);
+    if      (!valid1) _slot = 0;
+    else if (!valid0) _slot = 1;
+    else              _slot = (int8_t)(sequence1 - sequence0) > 0;
+    uint16_t address = slotAddress(_slot);
+    _sequence      = _slot ? sequence1 : sequence0;
+    _posError4bfdp = readS32(address +  0);
+    _negError4bfdp = readS32(address +  4);
+    _p00           = readS32(address +  8);
+    _p01           = readS32(address + 12);
+    _p11           = readS32(address + 16);
+}
+static void resetState()
+{
+    _posError4bfdp = (int32_t)_posAdjustMas << ERROR_SHIFT;
+    _negError4bfdp = (int32_t)_negAdjustMas << ERROR_SHIFT;
+    _p00 = PRIOR_VARIANCE;
+    _p01 = 0;
+    _p11 = PRIOR_VARIANCE;
+}
+static char stateIsValid()
+{
+    if (_p00 < 1 || _p00 > PRIOR_VARIANCE) return 0;
+    if (_p11 < 1 || _p11 > PRIOR_VARIANCE) return 0;
+    if (absolute(_p01) > PRIOR_VARIANCE)   return 0;
+    if (absolute(_posError4bfdp) > ((int32_t)MAX_ADJUST_MAS << ERROR_SHIFT) * 2) return 0;
+    if (absolute(_negError4bfdp) > ((int32_t)MAX_ADJUST_MAS << ERROR_SHIFT) * 2) return 0;
+    return 1;
+}
+
+static int16_t stepTowards(int16_t adjustMas, int32_t error4bfdp)
+{
+    int32_t target = (error4bfdp + (1 << (ERROR_SHIFT - 1))) >> ERROR_SHIFT;
+    if (target >  MAX_ADJUST_MAS) target =  MAX_ADJUST_MAS;
+    if (target < -MAX_ADJUST_MAS) target = -MAX_ADJUST_MAS;
+    int32_t step = target - adjustMas;
+    if (step >  MAX_STEP_MAS) step =  MAX_STEP_MAS;
+    if (step < -MAX_STEP_MAS) step = -MAX_STEP_MAS;
+    return (int16_t)(adjustMas + step);
+}
+
+void CalPulseAddCalibration(int32_t differenceMas, uint16_t posPulses, uint16_t negPulses)
+{
+    if ((uint32_t)posPulses + negPulses >= MIN_PULSES)
+    {
+        int32_t d = differenceMas + (int32_t)_posAdjustMas * posPulses - (int32_t)_negAdjustMas * negPulses;
+        if (update(d, posPulses, negPulses))
+        {
+            saveState();
+            int16_t newPos = stepTowards(_posAdjustMas, _posError4bfdp);
+            int16_t newNeg = stepTowards(_negAdjustMas, _negError4bfdp);
+            if (newPos != _posAdjustMas) CalPulseSetPosAdjustMas(newPos);
+            if (newNeg != _negAdjustMas) CalPulseSetNegAdjustMas(newNeg);
+        }
+    }
+    _msLastCalibration = MsTimerCount;
+}
+
+void CalPulseInit()
+{
+    _posAdjustMas = EepromThisReadS16(EEPROM_CAL_PULSE_POS_ADJUST_MAS_S16);
+    _negAdjustMas = EepromThisReadS16(EEPROM_CAL_PULSE_NEG_ADJUST_MAS_S16);
+    if (_posAdjustMas > MAX_ADJUST_MAS || _posAdjustMas < -MAX_ADJUST_MAS) _posAdjustMas = 0; //Uninitialised eeprom
+    if (_negAdjustMas > MAX_ADJUST_MAS || _negAdjustMas < -MAX_ADJUST_MAS) _negAdjustMas = 0;
+    _posCharge = makeCharge(_posAdjustMas);
+    _negCharge = makeCharge(_negAdjustMas);
+    
+    resetState();
+    readState();
+    if (!stateIsValid()) resetState(); //A slot which passed its crc by chance
+}
\ No newline at end of file
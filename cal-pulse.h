@@ -0,0 +1,12 @@
+#include <stdint.h>
+
+extern int16_t  CalPulseGetPosAdjustMas(void); extern void CalPulseSetPosAdjustMas(int16_t);
+extern int16_t  CalPulseGetNegAdjustMas(void); extern void CalPulseSetNegAdjustMas(int16_t);
+extern uint32_t CalPulseGetPosCharge(void); //Units of 1/1024 As per pulse
+extern uint32_t CalPulseGetNegCharge(void);
+extern uint32_t CalPulseGetPosVariance(void); //mAs^2 of the fitted adjustment
+extern uint32_t CalPulseGetNegVariance(void);
+
+extern void     CalPulseAddCalibration(int32_t differenceMas, uint16_t posPulses, uint16_t negPulses);
+
+extern void     CalPulseInit(void);
\ No newline at end of file
@@ -8,21 +8,77 @@
 #include "output.h"
 #include "temperature.h"
 #include "heater.h"
+#include "heater-tune.h"
+#include "preheat.h"
 #include "voltage.h"
 #include "rest.h"
 #include "cal-charge.h"
 #include "cal-current.h"
 #include "curve.h"
+#include "ocv.h"
+#include "cal-pulse.h"
+#include "soh.h"
+#include "stats.h"
+#include "eeprom-this.h"
 
 #define BASE_MS 1000
 
+/*
+Statistics
+==========
+The latest minute and hour buckets of each quantity are sent on change.
+Older buckets are read by sending STATS_SELECT: bit 7 = hours, bits 4 to 6 = quantity, bits 0 to 3 = age.
+The selected bucket is then sent on change as STATS_SELECTED.
+*/
+static uint8_t _statsSelect = 0;
+static uint8_t _curveSelect = 0;
+static void getSelectedStats(struct StatsBucket* pBucket)
+{
+    uint8_t quantity = (_statsSelect >> 4) & 7;
+    uint8_t age      =  _statsSelect       & 0xF;
+    char ok;
+    if (_statsSelect & 0x80) ok = StatsGetHour  (quantity, age, pBucket);
+    else                     ok = StatsGetMinute(quantity, age, pBucket);
+    if (!ok) pBucket->count = 0;
+}
+static void getStats(char hour, uint8_t quantity, struct StatsBucket* pBucket)
+{
+    char ok;
+    if (hour) ok = StatsGetHour  (quantity, 0, pBucket);
+    else      ok = StatsGetMinute(quantity, 0, pBucket);
+    if (!ok) pBucket->count = 0;
+}
+
+/*
+Curve
+=====
+A point is loaded by sending CURVE_POINT: index then the point. It is read by sending CURVE_SELECT with the index and
+is then sent on change as CURVE_SELECTED in the same layout.
+*/
+struct curvePointMessage
+{
+    uint8_t           index;
+    struct CurvePoint point;
+};
+static void receiveCurvePoint(void* pData)
+{
+    struct curvePointMessage* pMessage = pData;
+    CurveSetPoint(pMessage->index, &pMessage->point);
+}
+static void getSelectedCurvePoint(struct curvePointMessage* pMessage)
+{
+    pMessage->index = _curveSelect;
+    CurveGetPoint(_curveSelect, &pMessage->point);
+}
+
 static void receive(uint16_t id, uint8_t length, void* pData)
 {
     switch(id)
     {
-        case CAN_ID_SERVER  + CAN_ID_TIME:                    MsTickerRegulate              (*(uint32_t*)pData); break;
-        case CAN_ID_BATTERY + CAN_ID_COUNTED_AMP_SECONDS:     CountSetAmpSeconds            (*(uint32_t*)pData); break;
-        case CAN_ID_BATTERY + CAN_ID_MANAGE_PULSE_ADJUST_MAS: CalChargeSetPulseAdjustMas    (*( int16_t*)pData); break;
+        case CAN_ID_SERVER  + CAN_ID_TIME:                    EepromThisWaitForWrite(); MsTickerRegulate(*(uint32_t*)pData); break; //Msticker may save the length directly
+        case CAN_ID_BATTERY + CAN_ID_COUNTED_AMP_SECONDS:     CountSetAmpSeconds            (*(uint32_t*)pData); SohClearBaseline(); break;
+        case CAN_ID_BATTERY + CAN_ID_PULSE_POS_ADJUST_MAS:    CalPulseSetPosAdjustMas       (*( int16_t*)pData); break;
+        case CAN_ID_BATTERY + CAN_ID_PULSE_NEG_ADJUST_MAS:    CalPulseSetNegAdjustMas       (*( int16_t*)pData); break;
         case CAN_ID_BATTERY + CAN_ID_OUTPUT_TARGET_SOC:       OutputSetTargetSoc            (*( uint8_t*)pData); break;
         case CAN_ID_BATTERY + CAN_ID_CHARGE_ENABLED:          OutputSetChargeEnabled        (*(    char*)pData); break;
         case CAN_ID_BATTERY + CAN_ID_DISCHARGE_ENABLED:       OutputSetDischargeEnabled     (*(    char*)pData); break;
@@ -30,12 +86,27 @@ static void receive(uint16_t id, uint8_t length, void* pData)
         case CAN_ID_BATTERY + CAN_ID_CURRENT_OFFSET_MA:       CountSetCurrentOffsetMa       (*( int16_t*)pData); break;
         case CAN_ID_BATTERY + CAN_ID_HEATER_PROPORTIONAL:     HeaterSetKp8bfdp              (*(uint16_t*)pData); break;
         case CAN_ID_BATTERY + CAN_ID_HEATER_INTEGRAL:         HeaterSetKi8bfdp              (*(uint16_t*)pData); break;
+        case CAN_ID_BATTERY + CAN_ID_HEATER_TUNE:             if (*(char*)pData) HeaterTuneStart(); else HeaterTuneStop(); break;
         case CAN_ID_BATTERY + CAN_ID_OUTPUT_TARGET_MODE:      OutputSetTargetMode           (*(    char*)pData); break;
         case CAN_ID_BATTERY + CAN_ID_CURVE_INFLEXION_MV:      CurveSetInflexionCentreMv     (*( int16_t*)pData); break;
         case CAN_ID_BATTERY + CAN_ID_CURVE_INFLEXION_PERCENT: CurveSetInflexionCentrePercent(*( uint8_t*)pData); break;
         case CAN_ID_BATTERY + CAN_ID_CURRENT_SETTLE_MINS:     RestSetCurrentSettleTimeMins  (*(uint16_t*)pData); break;
         case CAN_ID_BATTERY + CAN_ID_VOLTAGE_SETTLE_MINS:     RestSetVoltageSettleTimeMins  (*(uint16_t*)pData); break;
         case CAN_ID_BATTERY + CAN_ID_VOLTAGE_REBOUND_MV:      OutputSetReboundMv            (*(  int8_t*)pData); break;
+        case CAN_ID_BATTERY + CAN_ID_VOLTAGE_MULTIPLIER:      VoltageSetMultiplier          (*(uint16_t*)pData); break;
+        case CAN_ID_BATTERY + CAN_ID_VOLTAGE_OFFSET_MV:       VoltageSetOffsetMv            (*( int16_t*)pData); break;
+        case CAN_ID_BATTERY + CAN_ID_VOLTAGE_CAL_LOW_MV:      VoltageCalibrateLowMv         (*( int16_t*)pData); break;
+        case CAN_ID_BATTERY + CAN_ID_VOLTAGE_CAL_HIGH_MV:     VoltageCalibrateHighMv        (*( int16_t*)pData); break;
+        case CAN_ID_BATTERY + CAN_ID_OCV_RESISTANCE_UOHM:     OcvSetResistanceUohm          (*(uint16_t*)pData); break;
+        case CAN_ID_BATTERY + CAN_ID_STATS_SELECT:            _statsSelect = *(uint8_t*)pData;                   break;
+        case CAN_ID_BATTERY + CAN_ID_CAPACITY_AH:             CountSetCapacityAh            (*(uint16_t*)pData); break;
+        case CAN_ID_BATTERY + CAN_ID_SOH_CAPACITY_DECI_AH:    SohSetCapacityDeciAh          (*(uint16_t*)pData); break;
+        case CAN_ID_BATTERY + CAN_ID_SOH_APPLY:               SohSetApply                   (*(char    *)pData); break;
+        case CAN_ID_BATTERY + CAN_ID_CURVE_POINT:             receiveCurvePoint             (               pData); break;
+        case CAN_ID_BATTERY + CAN_ID_CURVE_TEMP_A_10BFDP:     CurveSetTempA10bfdp           (*( int16_t*)pData); break;
+        case CAN_ID_BATTERY + CAN_ID_CURVE_TEMP_B_10BFDP:     CurveSetTempB10bfdp           (*( int16_t*)pData); break;
+        case CAN_ID_BATTERY + CAN_ID_CURVE_SELECT:            _curveSelect = *(uint8_t*)pData;                   break;
+        case CAN_ID_BATTERY + CAN_ID_OUTPUT_CLEAR_FAULT:      OutputClearFault              (                 ); break;
     }
 }
 
@@ -47,10 +118,25 @@ void CanThisMain(void)
 {
     { uint32_t value = CountGetAmpSeconds            (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_COUNTED_AMP_SECONDS    , sizeof(value), &value); }
     {  int32_t value = CalChargeGetDifferenceMas     (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_MANAGE_DIFFERENCE_MAS  , sizeof(value), &value); }
-    {  int16_t value = CalChargeGetPulseAdjustMas    (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_MANAGE_PULSE_ADJUST_MAS, sizeof(value), &value); }
+    {  int16_t value = CalPulseGetPosAdjustMas       (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_PULSE_POS_ADJUST_MAS   , sizeof(value), &value); }
+    {  int16_t value = CalPulseGetNegAdjustMas       (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_PULSE_NEG_ADJUST_MAS   , sizeof(value), &value); }
+    { uint32_t value = CalPulseGetPosVariance        (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_PULSE_POS_VARIANCE     , sizeof(value), &value); }
+    { uint32_t value = CalPulseGetNegVariance        (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_PULSE_NEG_VARIANCE     , sizeof(value), &value); }
+    { uint16_t value = CountGetCapacityAh            (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_CAPACITY_AH            , sizeof(value), &value); }
+    { uint16_t value = SohGetCapacityDeciAh          (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_SOH_CAPACITY_DECI_AH   , sizeof(value), &value); }
+    { uint16_t value = SohGetLastEstimateDeciAh      (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_SOH_LAST_ESTIMATE_DAH  , sizeof(value), &value); }
+    {     char value = SohGetApply                   (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_SOH_APPLY              , sizeof(value), &value); }
     { uint16_t value = CountGetPosPulses             (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_COUNT_POS_PULSES       , sizeof(value), &value); }
     { uint16_t value = CountGetNegPulses             (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_COUNT_NEG_PULSES       , sizeof(value), &value); }
     {  int32_t value = PulseGetCurrentMa             (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_MA                     , sizeof(value), &value); }
+    { struct StatsBucket value = {0}; getStats(0, STATS_CURRENT    , &value); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_STATS_MINUTE_CURRENT    , sizeof(value), &value); }
+    { struct StatsBucket value = {0}; getStats(0, STATS_VOLTAGE    , &value); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_STATS_MINUTE_VOLTAGE    , sizeof(value), &value); }
+    { struct StatsBucket value = {0}; getStats(0, STATS_TEMPERATURE, &value); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_STATS_MINUTE_TEMPERATURE, sizeof(value), &value); }
+    { struct StatsBucket value = {0}; getStats(1, STATS_CURRENT    , &value); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_STATS_HOUR_CURRENT      , sizeof(value), &value); }
+    { struct StatsBucket value = {0}; getStats(1, STATS_VOLTAGE    , &value); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_STATS_HOUR_VOLTAGE      , sizeof(value), &value); }
+    { struct StatsBucket value = {0}; getStats(1, STATS_TEMPERATURE, &value); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_STATS_HOUR_TEMPERATURE  , sizeof(value), &value); }
+    { struct StatsBucket value = {0}; getSelectedStats(              &value); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_STATS_SELECTED          , sizeof(value), &value); }
+    { uint16_t value = PulseGetGlitches              (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_PULSE_GLITCHES         , sizeof(value), &value); }
     {     char value = CalChargeGetIsActive          (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_CAL_CHARGE_IS_ACTIVE   , sizeof(value), &value); }
     {     char value = CalCurrentGetIsActive         (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_CAL_CURRENT_IS_ACTIVE  , sizeof(value), &value); }
     {     char value = RestGetIsAtRest               (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_IS_AT_REST             , sizeof(value), &value); }
@@ -59,22 +145,45 @@ void CanThisMain(void)
     {     char value = OutputGetState                (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_OUTPUT_STATE           , sizeof(value), &value); }
     {     char value = OutputGetChargeEnabled        (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_CHARGE_ENABLED         , sizeof(value), &value); }
     {     char value = OutputGetDischargeEnabled     (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_DISCHARGE_ENABLED      , sizeof(value), &value); }
+    {     char value = OutputGetFault                (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_OUTPUT_FAULT           , sizeof(value), &value); }
+    { uint32_t value = OutputGetTripLatencyMs        (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_OUTPUT_TRIP_LATENCY_MS  , sizeof(value), &value); }
     
     {  int16_t value = TemperatureGetAs8bfdp         (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_TEMPERATURE_8BFDP      , sizeof(value), &value); }
     {  int16_t value = HeaterGetTargetTenths         (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_HEATER_TARGET          , sizeof(value), &value); }
     {  uint8_t value = HeaterGetOutputFixed          (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_HEATER_OUTPUT          , sizeof(value), &value); }
     { uint16_t value = HeaterGetKp8bfdp              (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_HEATER_PROPORTIONAL    , sizeof(value), &value); }
     { uint16_t value = HeaterGetKi8bfdp              (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_HEATER_INTEGRAL        , sizeof(value), &value); }
+    {     char value = HeaterTuneGetState            (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_HEATER_TUNE            , sizeof(value), &value); }
+    { uint16_t value = HeaterTuneGetPeriodMins       (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_HEATER_TUNE_PERIOD_MINS, sizeof(value), &value); }
+    {  int16_t value = HeaterTuneGetAmplitude8bfdp   (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_HEATER_TUNE_AMPLITUDE  , sizeof(value), &value); }
+    {     char value = PreheatGetIsActive            (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_PREHEAT_ACTIVE         , sizeof(value), &value); }
+    { uint16_t value = PreheatGetRise8bfdp           (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_PREHEAT_RISE_8BFDP     , sizeof(value), &value); }
+    { uint16_t value = PreheatGetLoss8bfdp           (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_PREHEAT_LOSS_8BFDP     , sizeof(value), &value); }
+    { uint16_t value = PreheatGetLastWaitMins        (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_PREHEAT_WAIT_MINS      , sizeof(value), &value); }
+    { uint16_t value = PreheatGetLastWhTenths        (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_PREHEAT_WH_TENTHS      , sizeof(value), &value); }
     
     {  int16_t value = VoltageGetAsMv                (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_VOLTAGE                , sizeof(value), &value); }
     {  int16_t value = CountGetCurrentOffsetMa       (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_CURRENT_OFFSET_MA      , sizeof(value), &value); }
     
     {     char value = OutputGetTargetMode           (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_OUTPUT_TARGET_MODE     , sizeof(value), &value); }
     {  int16_t value = CurveGetInflexionCentreMv     (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_CURVE_INFLEXION_MV     , sizeof(value), &value); }
+    { struct curvePointMessage value = {0}; getSelectedCurvePoint(&value); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_CURVE_SELECTED         , sizeof(value), &value); }
+    {  int16_t value = CurveGetTempA10bfdp           (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_CURVE_TEMP_A_10BFDP    , sizeof(value), &value); }
+    {  int16_t value = CurveGetTempB10bfdp           (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_CURVE_TEMP_B_10BFDP    , sizeof(value), &value); }
+    {  int16_t value = CurveGetTempCorrectionMv      (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_CURVE_TEMP_CORRECTION_MV, sizeof(value), &value); }
+    {     char value = CurveGetTableIsValid          (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_CURVE_TABLE_IS_VALID   , sizeof(value), &value); }
+    {     char value = CurveGetIsCharging            (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_CURVE_IS_CHARGING      , sizeof(value), &value); }
     {  uint8_t value = CurveGetInflexionCentrePercent(); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_CURVE_INFLEXION_PERCENT, sizeof(value), &value); }
     { uint32_t value = RestGetMsAtRest               (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_MS_AT_REST             , sizeof(value), &value); }
     { uint16_t value = RestGetCurrentSettleTimeMins  (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_CURRENT_SETTLE_MINS    , sizeof(value), &value); }
     { uint16_t value = RestGetVoltageSettleTimeMins  (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_VOLTAGE_SETTLE_MINS    , sizeof(value), &value); }
+    {     char value = RestGetVoltageIsPredicted     (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_VOLTAGE_IS_PREDICTED   , sizeof(value), &value); }
+    {  int16_t value = RestGetRelaxBoundMv4bfdp      (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_RELAX_BOUND_MV4BFDP    , sizeof(value), &value); }
     {   int8_t value = OutputGetReboundMv            (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_VOLTAGE_REBOUND_MV     , sizeof(value), &value); }
+    { uint16_t value = VoltageGetMultiplier          (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_VOLTAGE_MULTIPLIER     , sizeof(value), &value); }
+    {  int16_t value = VoltageGetOffsetMv            (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_VOLTAGE_OFFSET_MV      , sizeof(value), &value); }
+    { uint16_t value = OcvGetResistanceUohm          (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_OCV_RESISTANCE_UOHM     , sizeof(value), &value); }
+    {  int16_t value = OcvGetMv                      (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_OCV_MV                 , sizeof(value), &value); }
+    {     char value = OcvGetIsConfident             (); static struct CanTransmitState state; CanTransmitOnChange(&state, CAN_ID_BATTERY, CAN_ID_OCV_IS_CONFIDENT       , sizeof(value), &value); }
     
 }
@@ -0,0 +1,48 @@
+#include <stdint.h>
+
+#include "cic.h"
+
+/*
+Second order cascaded integrator comb decimator
+===============================================
+Integrators run at the input rate; the combs run at the output rate.
+The output is the input passed through a triangular window 2 x rate - 1 samples long and has a gain of rate^2.
+So each output contains input bits + 2 x log2Rate bits; this must fit in 32 bits.
+All the arithmetic is modulo 2^32 so the integrators are allowed to wrap; the combs unwrap them.
+
+The comb delays start at zero so the first output only sees half the window: it is discarded.
+
+This file has no hardware dependencies so it can be compiled on a PC and checked against a straight sum and dump decimator.
+*/
+
+void CicReset(struct Cic* pCic)
+{
+    pCic->integrator1 = 0;
+    pCic->integrator2 = 0;
+    pCic->comb1       = 0;
+    pCic->comb2       = 0;
+    pCic->count       = 0;
+    pCic->isPrimed    = 0;
+}
+
+char CicAdd(struct Cic* pCic, uint32_t sample, uint8_t log2Rate, uint32_t* pOutput)
+{
+    pCic->integrator1 += sample;
+    pCic->integrator2 += pCic->integrator1;
+    pCic->count++;
+    if (pCic->count < (1U << log2Rate)) return 0;
+    pCic->count = 0;
+    
+    uint32_t stage1 = pCic->integrator2 - pCic->comb1;
+    pCic->comb1 = pCic->integrator2;
+    uint32_t stage2 = stage1 - pCic->comb2;
+    pCic->comb2 = stage1;
+    
+    if (!pCic->isPrimed)
+    {
+        pCic->isPrimed = 1;
+        return 0;
+    }
+    *pOutput = stage2;
+    return 1;
+}
@@ -0,0 +1,14 @@
+#include <stdint.h>
+
+struct Cic
+{
+    uint32_t integrator1;
+    uint32_t integrator2;
+    uint32_t comb1;
+    uint32_t comb2;
+    uint16_t count;
+    char     isPrimed;
+};
+
+extern void CicReset(struct Cic* pCic);
+extern char CicAdd  (struct Cic* pCic, uint32_t sample, uint8_t log2Rate, uint32_t* pOutput); //returns 1 when a decimated output is ready
@@ -1,56 +1,142 @@
 #include <stdint.h>
 
 #include "../mstimer.h"
-#include "../eeprom.h"
 
 #include "eeprom-this.h"
 #include "count.h"
+#include "journal.h"
 
-static uint32_t _capacityMilliAmpSeconds   = 0; //280Ah is 280 * 1000 * 3600 == 3C14 DC00. Could hold up to 1193Ah
-static uint32_t _milliAmpSeconds           = 0; //
+/*
+Charge
+======
+Charge is held in units of 1/1024 As (COUNT_UNITS_PER_AS) so the common conversions need no 32 bit divide which, with no
+hardware divider, is a library loop of hundreds of cycles:
+    As  = charge >> 10
+    mAs = charge x 1000 / 1024 = charge - charge x 3 / 128
+    Ah  = charge / (1024 x 3600) = (charge >> 14) / 225 ==> shift down 2 more, multiply by 2^21 / 225, shift down 21, then correct by at most one
+    %   = (charge + 0.5%) / 1% ==> multiply by a reciprocal worked out when the capacity is set, then correct by at most one
+The conversions keep the truncation of the old milliamp second versions and the percentage keeps adding 0.5 and taking the
+whole part. The setters are rare so still divide where they need to.
+Before and after cycle counts for the getters are out of scope: they need the XC8 build and the MPLAB simulator stopwatch.
+By operation count the As, mAs, Ah and percent getters each go from a 32 bit library divide to shifts, at most one
+multiply by a precomputed constant and a correction of at most one; mAh, only used by the display, still divides.
+280Ah is 280 x 3600 x 1024 == 3D85 0000. Could hold up to 1165Ah but the capacity is kept to COUNT_MAX_CAPACITY_AH so that 101%
+still fits for the percentage correction.
+
+The capacity is a setting; everything derived from it is worked out when it is set.
+*/
+#define AH_RECIPROCAL 9321UL //2^21 / 225
+
+static uint16_t _capacityAh                = 0;
+static uint32_t _capacity                  = 0; //Units of 1/1024 As
+static uint32_t _onePercent                = 0; //Capacity / 100
+static uint32_t _onePercentReciprocal      = 0; //2^32 / _onePercent: below 2^16 for capacities above 2Ah
+static uint32_t _charge                    = 0; //Units of 1/1024 As
 static  int16_t _currentOffsetMa           = 0;
+static uint32_t _currentOffsetUnits        = 0; //Magnitude of the current offset per second in whole units of 1/1024 As
+static uint16_t _currentOffsetThousandths  = 0; //and the thousandths of a unit left over
+static uint16_t _currentOffsetResidue      = 0; //Thousandths of a unit carried from one second to the next
 
 static uint16_t _positivePulses   = 0;
 static uint16_t _negativePulses   = 0;
 
-static uint16_t _lastSavedSoc = 0;
-static uint16_t _lastSavedPos = 0;
-static uint16_t _lastSavedNeg = 0;
+#define SAVE_MS 15000UL //See the wear calculation in journal.c
+
+static struct JournalRecord _lastSaved;
+
+static uint32_t fromMilliAmpSeconds(uint32_t mas) //mAs x 1024 / 1000 = mAs + mAs x 3 / 125 rounded up so that converting back gives the same mAs
+{
+    uint32_t extra = (mas / 125) * 3;
+    uint8_t  rem   = (uint8_t)(mas % 125);
+    return mas + extra + ((uint16_t)rem * 3 + 124) / 125;
+}
+static uint32_t toMilliAmpSeconds(uint32_t charge) //charge - ceil(charge x 3 / 128) == floor(charge x 1000 / 1024)
+{
+    return charge - (charge >> 7) * 3 - (((charge & 0x7F) * 3 + 127) >> 7);
+}
+static void setCurrentOffsetUnits() //Added every second so, unlike fromMilliAmpSeconds, keeps the remainder to be carried
+{
+    int16_t  ma = _currentOffsetMa < 0 ? -_currentOffsetMa : _currentOffsetMa;
+    uint32_t thousandths = (uint32_t)(uint16_t)ma * COUNT_UNITS_PER_AS;
+    _currentOffsetUnits       = thousandths / 1000;
+    _currentOffsetThousandths = (uint16_t)(thousandths % 1000);
+}
+static void setCapacity(uint32_t capacity)
+{
+    _capacity             = capacity;
+    _onePercent           = capacity / 100;
+    _onePercentReciprocal = 0xFFFFFFFF / _onePercent; //Only worked out when the capacity changes
+}
+
+static void setCapacityAh(uint16_t v)
+{
+    if (v < COUNT_MIN_CAPACITY_AH || v > COUNT_MAX_CAPACITY_AH) v = BATTERY_CAPACITY_AH; //Also catches an uninitialised eeprom
+    _capacityAh = v;
+    setCapacity(v * 3600UL * COUNT_UNITS_PER_AS);
+}
+uint16_t CountGetCapacityAh()           { return _capacityAh; }
+void     CountSetCapacityAh(uint16_t v)
+{
+    setCapacityAh(v);
+    if (_charge > _capacity) _charge = _capacity;
+    EepromThisSaveU16(EEPROM_COUNT_CAPACITY_AH_U16, _capacityAh);
+}
+uint32_t CountGetChargePerPercent()     { return _onePercent; }
 
 void CountInit()
 {
-    _capacityMilliAmpSeconds = BATTERY_CAPACITY_AH * 3600000;
-    _currentOffsetMa         = EepromReadS16(EEPROM_CURRENT_OFFSET_MA_S16);
-    
-    _lastSavedSoc = EepromReadU16(EEPROM_COUNT_SOC_MAS_U16);
-    _lastSavedPos = EepromReadU16(EEPROM_COUNT_POS_PULSES_U16);
-    _lastSavedNeg = EepromReadU16(EEPROM_COUNT_NEG_PULSES_U16);
-    _milliAmpSeconds         = (uint32_t)_lastSavedSoc << 16;
-    _positivePulses          = _lastSavedPos;
-    _negativePulses          = _lastSavedNeg;
+    setCapacityAh(EepromThisReadU16(EEPROM_COUNT_CAPACITY_AH_U16));
+    _currentOffsetMa         = EepromThisReadS16(EEPROM_CURRENT_OFFSET_MA_S16);
+    setCurrentOffsetUnits();
     
+    JournalInit();
+    if (!JournalRead(&_lastSaved)) //Fall back to the fixed addresses used before the journal
+    {
+        _lastSaved.milliAmpSeconds = (uint32_t)EepromThisReadU16(EEPROM_COUNT_SOC_MAS_U16) << 16;
+        _lastSaved.posPulses       =           EepromThisReadU16(EEPROM_COUNT_POS_PULSES_U16);
+        _lastSaved.negPulses       =           EepromThisReadU16(EEPROM_COUNT_NEG_PULSES_U16);
+    }
+    _charge          = fromMilliAmpSeconds(_lastSaved.milliAmpSeconds);
+    _positivePulses  = _lastSaved.posPulses;
+    _negativePulses  = _lastSaved.negPulses;
 }
 
 int16_t CountGetCurrentOffsetMa()           { return _currentOffsetMa;}
-void    CountSetCurrentOffsetMa( int16_t v) {        _currentOffsetMa = v; EepromSaveS16(EEPROM_CURRENT_OFFSET_MA_S16, _currentOffsetMa); } 
+void    CountSetCurrentOffsetMa( int16_t v) {        _currentOffsetMa = v; setCurrentOffsetUnits(); EepromThisSaveS16(EEPROM_CURRENT_OFFSET_MA_S16, _currentOffsetMa); } 
+void    CountTrimCurrentOffsetMa(int16_t v) {        _currentOffsetMa = v; setCurrentOffsetUnits();                                                      } //Not saved
 
-uint32_t CountGetAmpSeconds()           { return _milliAmpSeconds     / 1000; }
-void     CountSetAmpSeconds(uint32_t v) {        _milliAmpSeconds = v * 1000; }
+static char _hasSaturated = 0; //The count has hit empty or full since it was last set so it no longer follows the battery
+char     CountGetHasSaturated() { return _hasSaturated; }
 
-uint32_t CountGetMilliAmpSeconds()           { return _milliAmpSeconds; }
-void     CountSetMilliAmpSeconds(uint32_t v) {        _milliAmpSeconds = v; }
-void     CountAddMilliAmpSeconds(uint32_t v)
+uint32_t CountGetCharge()           { return _charge; }
+void     CountSetCharge(uint32_t v) {        _charge = v; _hasSaturated = 0; }
+void     CountAddCharge(uint32_t v)
+{
+    if (_charge < (_capacity - v)) _charge += v;
+    else                         { _charge  = _capacity; _hasSaturated = 1; }
+}
+void     CountSubCharge(uint32_t v)
 {
-    if (_milliAmpSeconds < (_capacityMilliAmpSeconds - v)) _milliAmpSeconds += v;
-    else                                                   _milliAmpSeconds  = _capacityMilliAmpSeconds;
+    if (_charge > v) _charge -= v;
+    else           { _charge  = 0; _hasSaturated = 1; }
 }
-void     CountSubMilliAmpSeconds(uint32_t v)
+
+uint32_t CountGetAmpSeconds()           { return _charge >> 10; }
+void     CountSetAmpSeconds(uint32_t v) { CountSetCharge(v << 10); }
+
+uint32_t CountGetMilliAmpSeconds()           { return toMilliAmpSeconds(_charge); }
+void     CountSetMilliAmpSeconds(uint32_t v) { CountSetCharge(fromMilliAmpSeconds(v)); }
+void     CountAddMilliAmpSeconds(uint32_t v) { CountAddCharge(fromMilliAmpSeconds(v)); }
+void     CountSubMilliAmpSeconds(uint32_t v) { CountSubCharge(fromMilliAmpSeconds(v)); }
+
+uint16_t CountGetAmpHours()
 {
-    if (_milliAmpSeconds > v) _milliAmpSeconds -= v;
-    else                      _milliAmpSeconds  = 0;
+    uint32_t units = _charge >> 14; //16As == 1/225 Ah
+    uint16_t ah = (uint16_t)((units >> 2) * AH_RECIPROCAL >> 21); //Both parts are rounded down so may be one low
+    while ((ah + 1UL) * 225 <= units) ah++;
+    return ah;
 }
-uint16_t CountGetAmpHours()             { return (uint16_t)(_milliAmpSeconds     / 3600000); }
-void     CountSetAmpHours(uint16_t v)   {                   _milliAmpSeconds = v * 3600000 ; }
+void     CountSetAmpHours(uint16_t v)   { CountSetCharge((uint32_t)v * 3600 * COUNT_UNITS_PER_AS); }
 /*
   0% = -0.5 to   0.4999%
   1% =  0.5 to   1.4999%
@@ -59,21 +145,19 @@ void     CountSetAmpHours(uint16_t v)   {                   _milliAmpSeconds = v
 
 so add 0.5 and take whole part
 */
-uint8_t  CountGetSocPercent()           { return (uint8_t)((_milliAmpSeconds + _capacityMilliAmpSeconds / 200) / (_capacityMilliAmpSeconds / 100)); }
-void     CountSetSocPercent(uint8_t v)  {                   _milliAmpSeconds = v                               * (_capacityMilliAmpSeconds / 100) ; }
-void     CountAddSocPercent(uint8_t v)
-{
-    uint32_t toAdd = (uint32_t)v * _capacityMilliAmpSeconds /  100;
-    CountAddMilliAmpSeconds(toAdd);
-}
-void     CountSubSocPercent(uint8_t v)
+uint8_t  CountGetSocPercent()
 {
-    uint32_t toAdd = (uint32_t)v * _capacityMilliAmpSeconds /  100;
-    CountSubMilliAmpSeconds(toAdd);
+    uint32_t charge = _charge + _onePercent / 2;
+    uint8_t percent = (uint8_t)(((charge >> 16) * _onePercentReciprocal) >> 16); //Both parts are rounded down so may be one low
+    while ((percent + 1) * _onePercent <= charge) percent++;
+    return percent;
 }
+void     CountSetSocPercent(uint8_t v)  { CountSetCharge(v * _onePercent); }
+void     CountAddSocPercent(uint8_t v)  { CountAddCharge(v * _onePercent); }
+void     CountSubSocPercent(uint8_t v)  { CountSubCharge(v * _onePercent); }
 
-uint32_t CountGetSoCmAh()             { return _milliAmpSeconds     / 3600; }
-void     CountSetSoCmAh(uint32_t v)   {        _milliAmpSeconds = v * 3600; }
+uint32_t CountGetSoCmAh()             { return CountGetMilliAmpSeconds() / 3600; }
+void     CountSetSoCmAh(uint32_t v)   { CountSetMilliAmpSeconds(v * 3600); }
 
 uint16_t CountGetPosPulses() { return _positivePulses;     }
 void     CountIncPosPulses() {        _positivePulses++;   }
@@ -88,28 +172,26 @@ void CountMain()
     static uint32_t _msTimerAging = 0;
     if (MsTimerRepetitive(&_msTimerAging, 1000))
     {
-        if (_currentOffsetMa > 0) CountAddMilliAmpSeconds((uint32_t)( _currentOffsetMa));
-        if (_currentOffsetMa < 0) CountSubMilliAmpSeconds((uint32_t)(-_currentOffsetMa));
+        uint32_t units = _currentOffsetUnits;
+        _currentOffsetResidue += _currentOffsetThousandths;
+        if (_currentOffsetResidue >= 1000) { _currentOffsetResidue -= 1000; units++; }
+        if (_currentOffsetMa > 0) CountAddCharge(units);
+        if (_currentOffsetMa < 0) CountSubCharge(units);
     }
 
-    //Save counts in case of reset but with at least a 5 minute gap to give a ten year eeprom life
-    static uint32_t _msTimerSaveSoc = 0;
-    static uint32_t _msTimerSavePos = 0;
-    static uint32_t _msTimerSaveNeg = 0;
-    uint16_t thisSoc = (uint16_t)(        _milliAmpSeconds >> 16);
-    if (thisSoc != _lastSavedSoc && MsTimerRepetitive(&_msTimerSaveSoc, 5UL * 60 * 1000))
-    {
-        EepromSaveU16(EEPROM_COUNT_SOC_MAS_U16, thisSoc);
-        _lastSavedSoc = thisSoc;
-    }
-    if (_positivePulses != _lastSavedPos && MsTimerRepetitive(&_msTimerSavePos, 5UL * 60 * 1000))
-    {
-        EepromSaveU16(EEPROM_COUNT_POS_PULSES_U16, _positivePulses);
-        _lastSavedPos = _positivePulses;
-    }
-    if (_negativePulses != _lastSavedNeg && MsTimerRepetitive(&_msTimerSaveNeg, 5UL * 60 * 1000))
+    //Save counts in case of reset to the journal which spreads the wear
+    static uint32_t _msTimerSave = 0;
+    if (MsTimerRepetitive(&_msTimerSave, SAVE_MS))
     {
-        EepromSaveU16(EEPROM_COUNT_NEG_PULSES_U16, _negativePulses);
-        _lastSavedNeg = _negativePulses;
+        uint32_t milliAmpSeconds = toMilliAmpSeconds(_charge);
+        if (milliAmpSeconds != _lastSaved.milliAmpSeconds ||
+            _positivePulses  != _lastSaved.posPulses       ||
+            _negativePulses  != _lastSaved.negPulses)
+        {
+            _lastSaved.milliAmpSeconds = milliAmpSeconds;
+            _lastSaved.posPulses       = _positivePulses;
+            _lastSaved.negPulses       = _negativePulses;
+            JournalWrite(&_lastSaved);
+        }
     }
 }
\ No newline at end of file
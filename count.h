@@ -2,6 +2,17 @@
 
 extern  int16_t CountGetCurrentOffsetMa(void);
 extern  void    CountSetCurrentOffsetMa(int16_t v);
+extern  void    CountTrimCurrentOffsetMa(int16_t v);
+
+extern uint16_t CountGetCapacityAh(void);
+extern void     CountSetCapacityAh(uint16_t v);
+extern uint32_t CountGetChargePerPercent(void);
+
+extern char     CountGetHasSaturated(void);
+extern uint32_t CountGetCharge(void); //Units of 1/1024 As
+extern void     CountSetCharge(uint32_t v);
+extern void     CountAddCharge(uint32_t v);
+extern void     CountSubCharge(uint32_t v);
 
 extern uint32_t CountGetMilliAmpSeconds(void);
 extern void     CountSetMilliAmpSeconds(uint32_t v);
@@ -35,4 +46,8 @@ extern void     CountResNegPulses(void);
 extern void     CountInit(void);
 extern void     CountMain(void);
 
-#define BATTERY_CAPACITY_AH 280
\ No newline at end of file
+#define BATTERY_CAPACITY_AH 280 //Default until set
+#define COUNT_MIN_CAPACITY_AH  10
+#define COUNT_MAX_CAPACITY_AH 1153 //101% must fit in 32 bits for CountGetSocPercent
+
+#define COUNT_UNITS_PER_AS 1024
\ No newline at end of file
@@ -1,54 +1,214 @@
 #include <stdint.h>
 
-#include "../eeprom.h"
-
 #include "count.h"
+#include "curve.h"
 #include "eeprom-this.h"
+#include "temperature.h"
+
+/*
+Open circuit voltage table
+==========================
+The table gives the rest voltage of a cell at each of CURVE_POINT_COUNT states of charge from 0% to 100%.
+LiFePO4 has hysteresis so each point has a voltage for after charging and one for after discharging; the branch used is
+the direction the count last moved by more than BRANCH_HYSTERESIS_PERCENT.
+A voltage is looked up by a binary search for its segment followed by linear interpolation.
+
+Each segment has a confidence from its slope: at SLOPE_FOR_FULL_CONFIDENCE mV per % or more a 1mV error is worth 0.2% so
+the confidence is 100; the flat middle of the curve gets much less so calibration can choose not to trust it.
+
+The table is loaded over CAN. Points are saved to the eeprom as they arrive and the table is only used once it is valid:
+0% first, 100% last and everything rising.
+
+Temperature
+===========
+The plateau moves with temperature so a measured voltage is first corrected back to 25 degrees:
+    correction = a x (T - 25) + b x (T - 25)^2
+with a in mV per degree and b in mV per degree squared, both per cell with 10 binary places, so 0.001mV resolution.
+The correction is only worked out when the temperature changes so the lookup costs one subtraction.
 
+The inflexion window
+====================
+Until a valid table is loaded the lookup falls back to the original fixed window of +/- INFLEXION_CELL_MV_MAX around the
+inflexion centre, treated as fully confident, so an unconfigured battery calibrates as before.
+The inflexion centre and width are also used by the voltage target in output.c; CurveGetInflexionAsFromMv is the lookup
+limited to the window.
+*/
 #define INFLEXION_CELL_MV_MAX 15
+#define BRANCH_HYSTERESIS_PERCENT 1
+#define SLOPE_FOR_FULL_CONFIDENCE 5 //mV per %
 
 static int16_t  _inflexionCentreMv      = 0;
 static uint8_t  _inflexionCentrePercent = 0;
 static uint32_t _inflexionCentreAs      = 0;
 
-static const uint16_t inflexionAmpSeconds[] =
-{
-     0U * BATTERY_CAPACITY_AH * 36 / 10, // 0
-     1U * BATTERY_CAPACITY_AH * 36 / 10, // 1
-     2U * BATTERY_CAPACITY_AH * 36 / 10, // 2
-     3U * BATTERY_CAPACITY_AH * 36 / 10, // 3
-     4U * BATTERY_CAPACITY_AH * 36 / 10, // 4
-     5U * BATTERY_CAPACITY_AH * 36 / 10, // 5
-     6U * BATTERY_CAPACITY_AH * 36 / 10, // 6
-     7U * BATTERY_CAPACITY_AH * 36 / 10, // 7
-     8U * BATTERY_CAPACITY_AH * 36 / 10, // 8
-     9U * BATTERY_CAPACITY_AH * 36 / 10, // 9
-    10U * BATTERY_CAPACITY_AH * 36 / 10, //10
-    12U * BATTERY_CAPACITY_AH * 36 / 10, //11
-    14U * BATTERY_CAPACITY_AH * 36 / 10, //12
-    16U * BATTERY_CAPACITY_AH * 36 / 10, //13
-    18U * BATTERY_CAPACITY_AH * 36 / 10, //14
-    20U * BATTERY_CAPACITY_AH * 36 / 10  //15
-};
-int16_t  CurveGetInflexionCentreMv     () { return _inflexionCentreMv;      } void CurveSetInflexionCentreMv     (int16_t v) { _inflexionCentreMv      = v;                                        EepromSaveS16(EEPROM_CURVE_INFLEXION_MV_S16     , v  ); } 
-uint8_t  CurveGetInflexionCentrePercent() { return _inflexionCentrePercent; } void CurveSetInflexionCentrePercent(uint8_t v) { _inflexionCentrePercent = v;  _inflexionCentreAs = v * 36UL * 280 ; EepromSaveU8 (EEPROM_CURVE_INFLEXION_PERCENT_U8 , v  ); } 
-uint32_t CurveGetInflexionCentreAs     () { return _inflexionCentreAs;      }
-int8_t   CurveGetInflexionWidthMv      () { return INFLEXION_CELL_MV_MAX;   }
+static const uint8_t inflexionTenthsOfPercent[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 14, 16, 18, 20 }; //Index is mV from the centre
 
-char     CurveGetInflexionAsFromMv(int16_t mv, uint32_t* pAs) //returns 0 if ok or -1 if mv is out of range.
+static struct CurvePoint _table[CURVE_POINT_COUNT];
+static char    _tableIsValid = 0;
+static uint8_t _confidence[2][CURVE_POINT_COUNT - 1]; //[discharge, charge][segment]
+static char    _charging     = 0;
+
+static int16_t  _tempA10bfdp     = 0;
+static int16_t  _tempB10bfdp     = 0;
+static int16_t  _correctionMv    = 0;
+static int16_t  _correctionFor8bfdp = 0; //Temperature the correction was worked out for
+static char     _correctionIsSet = 0;
+
+static uint16_t _capacityAh = 0;                //Capacity the values below were worked out for
+static uint32_t _asPerPercent = 0;
+
+static int16_t getMv(uint8_t i, char charging) { return charging ? _table[i].chargeMv : _table[i].dischargeMv; }
+
+static void makeValues() //Only called when the capacity, the centre percent or the table changes
+{
+    _capacityAh = CountGetCapacityAh();
+    _asPerPercent = 36UL * _capacityAh;
+    _inflexionCentreAs = _inflexionCentrePercent * _asPerPercent;
+    
+    _tableIsValid = _table[0].percent == 0 && _table[CURVE_POINT_COUNT - 1].percent == 100;
+    for (uint8_t i = 0; i < CURVE_POINT_COUNT - 1; i++)
+    {
+        uint8_t percentSpan = _table[i + 1].percent - _table[i].percent;
+        for (char charging = 0; charging < 2; charging++)
+        {
+            int16_t mvSpan = getMv(i + 1, charging) - getMv(i, charging);
+            if (_table[i + 1].percent <= _table[i].percent || mvSpan <= 0) { _tableIsValid = 0; continue; }
+            uint32_t confidence = (uint32_t)mvSpan * 100 / ((uint16_t)percentSpan * SLOPE_FOR_FULL_CONFIDENCE);
+            _confidence[charging][i] = confidence > 100 ? 100 : (uint8_t)confidence;
+        }
+    }
+}
+static void checkCapacity()
+{
+    if (_capacityAh != CountGetCapacityAh()) makeValues();
+}
+
+static char getAsFromInflexionWindow(int16_t mv, uint32_t* pAs, uint8_t* pConfidence)
 {
     int16_t mvIndex = mv - _inflexionCentreMv;
     char isNegative = mvIndex < 0;
     int16_t absMv = isNegative ? -mvIndex : mvIndex;
     if (absMv > INFLEXION_CELL_MV_MAX) return 1; //Return invalid
-    uint16_t absAs = inflexionAmpSeconds[absMv];
+    checkCapacity();
+    uint32_t absAs = inflexionTenthsOfPercent[absMv] * _asPerPercent / 10;
     *pAs = isNegative ? _inflexionCentreAs - absAs : _inflexionCentreAs + absAs;
+    *pConfidence = 100;
     return 0;
 }
 
+static uint16_t getAddress(uint8_t i) { return EEPROM_CURVE_TABLE + (uint16_t)i * 5; }
+
+void CurveGetPoint(uint8_t i, struct CurvePoint* pPoint)
+{
+    if (i >= CURVE_POINT_COUNT) return;
+    *pPoint = _table[i];
+}
+void CurveSetPoint(uint8_t i, struct CurvePoint* pPoint)
+{
+    if (i >= CURVE_POINT_COUNT) return;
+    _table[i] = *pPoint;
+    uint16_t address = getAddress(i);
+    EepromThisSaveU8 (address + 0, pPoint->percent    );
+    EepromThisSaveS16(address + 1, pPoint->chargeMv   );
+    EepromThisSaveS16(address + 3, pPoint->dischargeMv);
+    makeValues();
+}
+static void makeCorrection()
+{
+    int16_t t8bfdp = TemperatureGetAs8bfdp();
+    _correctionFor8bfdp = t8bfdp;
+    _correctionIsSet    = 1;
+    
+    int32_t dT8bfdp = (int32_t)t8bfdp - (25 << 8);
+    int32_t dT4bfdp = dT8bfdp >> 4;
+    int32_t dT2     = (dT4bfdp * dT4bfdp) >> 8;                         //Whole degrees squared
+    int32_t mv10bfdp = ((int32_t)_tempA10bfdp * dT8bfdp >> 8) + (int32_t)_tempB10bfdp * dT2;
+    _correctionMv = (int16_t)((mv10bfdp + 512) >> 10);
+}
+static int16_t correct(int16_t mv)
+{
+    if (!TemperatureIsValid) return mv;
+    if (!_correctionIsSet || TemperatureGetAs8bfdp() != _correctionFor8bfdp) makeCorrection();
+    return mv - _correctionMv;
+}
+int16_t CurveGetTempA10bfdp() { return _tempA10bfdp; } void CurveSetTempA10bfdp(int16_t v) { _tempA10bfdp = v; _correctionIsSet = 0; EepromThisSaveS16(EEPROM_CURVE_TEMP_A_10BFDP_S16, v); }
+int16_t CurveGetTempB10bfdp() { return _tempB10bfdp; } void CurveSetTempB10bfdp(int16_t v) { _tempB10bfdp = v; _correctionIsSet = 0; EepromThisSaveS16(EEPROM_CURVE_TEMP_B_10BFDP_S16, v); }
+int16_t CurveGetTempCorrectionMv() { return TemperatureIsValid ? _correctionMv : 0; }
+
+char CurveGetTableIsValid() { return _tableIsValid; }
+char CurveGetIsCharging  () { return _charging;     }
+
+char CurveGetAsFromMv(int16_t mv, uint32_t* pAs, uint8_t* pConfidence) //returns 0 if ok or 1 if mv is out of range.
+{
+    mv = correct(mv);
+    if (!_tableIsValid) return getAsFromInflexionWindow(mv, pAs, pConfidence);
+    char charging = _charging;
+    if (mv < getMv(0, charging) || mv > getMv(CURVE_POINT_COUNT - 1, charging)) return 1;
+    
+    uint8_t low  = 0;                     //Find the segment with getMv(low) <= mv <= getMv(low + 1)
+    uint8_t high = CURVE_POINT_COUNT - 1;
+    while (high - low > 1)
+    {
+        uint8_t middle = (low + high) / 2;
+        if (getMv(middle, charging) <= mv) low  = middle;
+        else                               high = middle;
+    }
+    
+    checkCapacity();
+    int16_t  lowMv       = getMv(low, charging);
+    uint16_t mvSpan      = (uint16_t)(getMv(high, charging) - lowMv);
+    uint32_t percentSpan = _table[high].percent - _table[low].percent;
+    *pAs = _table[low].percent * _asPerPercent + (uint32_t)(mv - lowMv) * percentSpan * _asPerPercent / mvSpan;
+    *pConfidence = _confidence[charging][low];
+    return 0;
+}
+
+int16_t  CurveGetInflexionCentreMv     () { return _inflexionCentreMv;      } void CurveSetInflexionCentreMv     (int16_t v) { _inflexionCentreMv      = v;                                        EepromThisSaveS16(EEPROM_CURVE_INFLEXION_MV_S16     , v  ); } 
+uint8_t  CurveGetInflexionCentrePercent() { return _inflexionCentrePercent; } void CurveSetInflexionCentrePercent(uint8_t v) { _inflexionCentrePercent = v;  makeValues();                       EepromThisSaveU8 (EEPROM_CURVE_INFLEXION_PERCENT_U8 , v  ); } 
+uint32_t CurveGetInflexionCentreAs     () { checkCapacity(); return _inflexionCentreAs; }
+int8_t   CurveGetInflexionWidthMv      () { return INFLEXION_CELL_MV_MAX;   }
+
+char     CurveGetInflexionAsFromMv(int16_t mv, uint32_t* pAs) //returns 0 if ok or -1 if mv is out of range.
+{
+    int16_t mvIndex = mv - _inflexionCentreMv;
+    if (mvIndex > INFLEXION_CELL_MV_MAX || mvIndex < -INFLEXION_CELL_MV_MAX) return 1; //Return invalid
+    uint8_t confidence;
+    return CurveGetAsFromMv(mv, pAs, &confidence);
+}
+
 void CurveInit()
 {
-    _inflexionCentreMv      = EepromReadS16(EEPROM_CURVE_INFLEXION_MV_S16    );
-    _inflexionCentrePercent = EepromReadU8 (EEPROM_CURVE_INFLEXION_PERCENT_U8);
-    _inflexionCentreAs = _inflexionCentrePercent * 36UL * 280;
+    _inflexionCentreMv      = EepromThisReadS16(EEPROM_CURVE_INFLEXION_MV_S16    );
+    _inflexionCentrePercent = EepromThisReadU8 (EEPROM_CURVE_INFLEXION_PERCENT_U8);
+    
+    for (uint8_t i = 0; i < CURVE_POINT_COUNT; i++)
+    {
+        uint16_t address = getAddress(i);
+        _table[i].percent     = EepromThisReadU8 (address + 0);
+        _table[i].chargeMv    = EepromThisReadS16(address + 1);
+        _table[i].dischargeMv = EepromThisReadS16(address + 3);
+    }
+    _tempA10bfdp = EepromThisReadS16(EEPROM_CURVE_TEMP_A_10BFDP_S16);
+    _tempB10bfdp = EepromThisReadS16(EEPROM_CURVE_TEMP_B_10BFDP_S16);
+    if (_tempA10bfdp == -1 && _tempB10bfdp == -1) { _tempA10bfdp = 0; _tempB10bfdp = 0; } //Uninitialised eeprom
+    makeValues();
 }
+void CurveMain()
+{
+    static uint32_t turningCharge = 0; //Highest charge since charging started or lowest since discharging started
+    static char     started       = 0;
+    
+    uint32_t charge     = CountGetCharge();
+    if (!started) { turningCharge = charge; started = 1; }
+    uint32_t hysteresis = CountGetChargePerPercent() * BRANCH_HYSTERESIS_PERCENT;
+    if (_charging)
+    {
+        if      (charge > turningCharge             ) turningCharge = charge;
+        else if (turningCharge - charge > hysteresis) { _charging = 0; turningCharge = charge; }
+    }
+    else
+    {
+        if      (charge < turningCharge             ) turningCharge = charge;
+        else if (charge - turningCharge > hysteresis) { _charging = 1; turningCharge = charge; }
+    }
+}
\ No newline at end of file
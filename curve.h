@@ -1,9 +1,27 @@
 #include <stdint.h>
 
+struct CurvePoint
+{
+    uint8_t percent;
+    int16_t chargeMv;    //Cell rest voltage after charging
+    int16_t dischargeMv; //Cell rest voltage after discharging
+};
+#define CURVE_POINT_COUNT 16
+
+extern void     CurveGetPoint(uint8_t i, struct CurvePoint* pPoint);
+extern void     CurveSetPoint(uint8_t i, struct CurvePoint* pPoint);
+extern char     CurveGetTableIsValid(void);
+extern char     CurveGetIsCharging(void);
+extern int16_t  CurveGetTempA10bfdp(void); extern void CurveSetTempA10bfdp(int16_t); //mV per degree per cell
+extern int16_t  CurveGetTempB10bfdp(void); extern void CurveSetTempB10bfdp(int16_t); //mV per degree squared per cell
+extern int16_t  CurveGetTempCorrectionMv(void);
+extern char     CurveGetAsFromMv(int16_t mv, uint32_t* pAs, uint8_t* pConfidence); //returns 0 if ok or 1 if mv is out of range; confidence is 0 to 100
+
 extern int16_t  CurveGetInflexionCentreMv     (void); extern void CurveSetInflexionCentreMv     (int16_t);
 extern uint8_t  CurveGetInflexionCentrePercent(void); extern void CurveSetInflexionCentrePercent(uint8_t);
 extern uint32_t CurveGetInflexionCentreAs     (void);
 extern int8_t   CurveGetInflexionWidthMv      (void);
 extern char     CurveGetInflexionAsFromMv     (int16_t mv, uint32_t* pAs); //returns 0 if ok or -1 if mv is out of range.
 
-extern void CurveInit(void);
\ No newline at end of file
+extern void CurveInit(void);
+extern void CurveMain(void);
\ No newline at end of file
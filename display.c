@@ -7,18 +7,20 @@
 
 #include "../msticker.h"
 #include "../mstimer.h"
-#include "../eeprom.h"
-#include "../lcd-1602.h"
 
+#include "lcd-this.h"
 #include "voltage.h"
 #include "adc.h"
 #include "pulse.h"
+#include "stats.h"
 #include "count.h"
 #include "temperature.h"
 #include "keypad.h"
 #include "eeprom-this.h"
 #include "output.h"
 #include "heater.h"
+#include "heater-tune.h"
+#include "handoff.h"
 
 #define REPEAT_TIME_MS    1000
 
@@ -28,7 +30,8 @@
 #define PAGE_SOC_COUNTED  3
 #define PAGE_OUTPUT       4
 #define PAGE_HEATER       5
-#define MAX_PAGE 5
+#define PAGE_TRENDS       6
+#define MAX_PAGE 6
 
 #define LINE_LENGTH 16
 
@@ -41,7 +44,7 @@ static  int8_t _setting        = 0; //0 == display page
 
 void DisplayInit()
 {
-    _displayOnTime = EepromReadU8(EEPROM_DISPLAY_ON_TIME_U8);
+    _displayOnTime = EepromThisReadU8(EEPROM_DISPLAY_ON_TIME_U8);
 }
 
 static uint32_t getStayOnTimeSeconds()
@@ -69,12 +72,12 @@ static void incrementStayOnFactor()
 {
     if (_displayOnTime < 14) _displayOnTime++;
     else                     _displayOnTime = 14;
-    EepromSaveU8(EEPROM_DISPLAY_ON_TIME_U8, _displayOnTime);
+    EepromThisSaveU8(EEPROM_DISPLAY_ON_TIME_U8, _displayOnTime);
 }
 static void decrementStayOnFactor()
 {
     if (_displayOnTime > 0) _displayOnTime--;
-    EepromSaveU8(EEPROM_DISPLAY_ON_TIME_U8, _displayOnTime);
+    EepromThisSaveU8(EEPROM_DISPLAY_ON_TIME_U8, _displayOnTime);
 }
 static int addStayOnTimeText(char* p) //Returns a length of 10
 {
@@ -200,6 +203,7 @@ static void displayHome3()
 static void displayHome4()
 {
     snprintf(line0, 17, "Scan time %dms", MsTimerScanTime);
+    snprintf(line1, 17, "Retries %u", HandoffGetRetries());
 }
 
 static void displayCurrent0()
@@ -225,6 +229,11 @@ static void displaySocCounted2()
     strncpy(line0, "Aging As/hour?", 16);
     snprintf(line1, 17, "%d", CountGetCurrentOffsetMa());
 }
+static void displaySocCounted3()
+{
+    strncpy(line0, "Capacity Ah?", 16);
+    snprintf(line1, 17, "%u", CountGetCapacityAh());
+}
 static void displayOutput0()
 {
     int32_t ma = PulseGetCurrentMa();
@@ -301,6 +310,61 @@ static void displayHeater3()
     p += addString(p, "Ki? ");
     snprintf(line1, 17, "%d", HeaterGetKi8bfdp());
 }
+static void displayHeater4()
+{
+    char* p = line0;
+    p += addString(p, "Auto tune? ");
+    switch (HeaterTuneGetState())
+    {
+        case HEATER_TUNE_RUNNING: p += addString(p, "run");  break;
+        case HEATER_TUNE_DONE:    p += addString(p, "done"); break;
+        case HEATER_TUNE_FAILED:  p += addString(p, "fail"); break;
+        default:                  p += addString(p, "off");  break;
+    }
+    int16_t tenths = TemperatureConvert8bfdpToTenths(HeaterTuneGetAmplitude8bfdp());
+    snprintf(line1, 17, "Tu %um a %d.%dC", HeaterTuneGetPeriodMins(), tenths / 10, tenths % 10);
+}
+static char getTrend(uint8_t quantity, struct StatsBucket* pBucket) //Returns 'h' for the last hour, 'm' for the last minute or 0 if none yet
+{
+    if (StatsGetHour  (quantity, 0, pBucket)) return 'h';
+    if (StatsGetMinute(quantity, 0, pBucket)) return 'm';
+    return 0;
+}
+static void displayTrends0()
+{
+    struct StatsBucket b;
+    char period = getTrend(STATS_VOLTAGE, &b);
+    if (!period) { strcpy(line0, "Trend V ?"); return; }
+    snprintf(line0, 17, "V1%c %2d.%02d-%2d.%02d", period, b.min / 1000, b.min % 1000 / 10, b.max / 1000, b.max % 1000 / 10);
+    strcpy(line1, "   mean ");
+    addVoltage(line1 + 8, b.mean);
+}
+static void displayTrends1()
+{
+    struct StatsBucket b;
+    char period = getTrend(STATS_CURRENT, &b);
+    if (!period) { strcpy(line0, "Trend I ?"); return; }
+    line0[0] = 'I'; line0[1] = '1'; line0[2] = period;
+    addCurrent(line0 + 3, b.min * 10L);
+    line0[9] = ' ';
+    addCurrent(line0 + 10, b.max * 10L);
+    strcpy(line1, "   mean ");
+    addCurrent(line1 + 8, b.mean * 10L);
+}
+static void displayTrends2()
+{
+    struct StatsBucket b;
+    char period = getTrend(STATS_TEMPERATURE, &b);
+    if (!period) { strcpy(line0, "Trend T ?"); return; }
+    char* p = line0;
+    *p++ = 'T'; *p++ = '1'; *p++ = period; *p++ = ' ';
+    p += addTemperatureTenths(p, b.min);
+    *p++ = ' ';
+    p += addTemperatureTenths(p, b.max);
+    p = line1;
+    p += addString(p, "   mean ");
+    p += addTemperatureTenths(p, b.mean);
+}
 
 static uint32_t addUint32(uint32_t oldValue, uint32_t amount) { return oldValue < (uint32_t)-amount ?           oldValue + amount  : (uint32_t)-1; }
 static uint16_t addUint16(uint16_t oldValue, uint16_t amount) { return oldValue < (uint16_t)-amount ?           oldValue + amount  : (uint16_t)-1; }
@@ -333,6 +397,7 @@ static void adjustSetting(char increase, uint16_t amount)
                     uint16_t newValue;
                     if (increase) newValue = addUint16(MsTickerGetLength(), amount);
                     else          newValue = subUint16(MsTickerGetLength(), amount);
+                    EepromThisWaitForWrite(); //Msticker saves the length directly
                     MsTickerSetLength(newValue);
                     break;
                 }
@@ -358,6 +423,17 @@ static void adjustSetting(char increase, uint16_t amount)
                     CountSetCurrentOffsetMa(newValue);
                     break;
                 }
+                case 3:
+                {
+                    if (amount > 100) amount = 100;
+                    uint16_t newValue;
+                    if (increase) newValue = addUint16(CountGetCapacityAh(), amount);
+                    else          newValue = subUint16(CountGetCapacityAh(), amount);
+                    if (newValue > COUNT_MAX_CAPACITY_AH) newValue = COUNT_MAX_CAPACITY_AH;
+                    if (newValue < COUNT_MIN_CAPACITY_AH) newValue = COUNT_MIN_CAPACITY_AH;
+                    CountSetCapacityAh(newValue);
+                    break;
+                }
             }
             break;
         case PAGE_OUTPUT:
@@ -413,6 +489,12 @@ static void adjustSetting(char increase, uint16_t amount)
                     HeaterSetKi8bfdp(newValue);
                     break;
                 }
+                case 4:
+                {
+                    if (increase) HeaterTuneStart();
+                    else          HeaterTuneStop();
+                    break;
+                }
             }
             break;
     }
@@ -491,9 +573,10 @@ void DisplayMain()
                     {
                         case PAGE_HOME        : if (_setting > 4) _setting = 0; break;
                         case PAGE_CURRENT     : if (_setting > 0) _setting = 0; break;
-                        case PAGE_SOC_COUNTED : if (_setting > 2) _setting = 0; break;
+                        case PAGE_SOC_COUNTED : if (_setting > 3) _setting = 0; break;
                         case PAGE_OUTPUT      : if (_setting > 2) _setting = 0; break;
-                        case PAGE_HEATER      : if (_setting > 3) _setting = 0; break;
+                        case PAGE_HEATER      : if (_setting > 4) _setting = 0; break;
+                        case PAGE_TRENDS      : if (_setting > 2) _setting = 0; break;
                     }
                 }
                 else
@@ -506,11 +589,11 @@ void DisplayMain()
         }
     }
     
-    if (!_page &&  LcdIsOn()) LcdTurnOff();
-    if ( _page && !LcdIsOn()) LcdTurnOn();
+    if (!_page &&  LcdThisIsOn()) LcdThisTurnOff();
+    if ( _page && !LcdThisIsOn()) LcdThisTurnOn();
     
     if ( _page && 
-         LcdIsReady() && 
+         LcdThisIsReady() && 
          (MsTimerRepetitive(&msRepetitiveTimer, REPEAT_TIME_MS) || _page != currentPage || _setting != currentSetting || settingChanged))
     {
         for (int i = 0; i < 16; i++) line0[i] = ' ';
@@ -537,6 +620,7 @@ void DisplayMain()
                     case 0: displaySocCounted0(); break;
                     case 1: displaySocCounted1(); break;
                     case 2: displaySocCounted2(); break;
+                    case 3: displaySocCounted3(); break;
                 }
                 break;
             }
@@ -558,12 +642,23 @@ void DisplayMain()
                     case 1: displayHeater1(); break;
                     case 2: displayHeater2(); break;
                     case 3: displayHeater3(); break;
+                    case 4: displayHeater4(); break;
+                }
+                break;
+            }
+            case PAGE_TRENDS:
+            {
+                switch (_setting)
+                {
+                    case 0: displayTrends0(); break;
+                    case 1: displayTrends1(); break;
+                    case 2: displayTrends2(); break;
                 }
                 break;
             }
         }
        
-       LcdSendText(line0, line1);
+       LcdThisSendText(line0, line1);
        currentPage = _page;
        currentSetting = _setting;
     }
@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include <xc.h>
+
+#include "eeprom-this.h"
+
+/*
+Write behind
+============
+A byte takes about 4ms to write so saving straight to the eeprom stalls the main loop whenever a setting changes.
+Instead the first EEPROM_SHADOW_SIZE bytes, which hold all the settings, are read into a ram shadow at start up.
+A save only changes the shadow and marks the byte dirty; saving the same value again costs nothing so repeated saves
+of a setting coalesce into one write. Reads come from the shadow.
+Addresses above the shadow, such as the journal, go into a short fifo in the order they were saved; a read checks the
+fifo before the eeprom. If the fifo is full the save waits for a slot.
+
+EepromThisMain starts at most one write per pass, taking the lowest dirty byte first so the bytes of a value, or of a
+record with a byte written last on purpose, go in address order. The write complete interrupt says when the next can
+start. A byte which already holds its value is skipped without writing so there is no extra wear.
+EepromThisFlush waits until everything is written and is for values which must survive an immediate loss of power.
+
+Multi byte values are stored least significant byte first.
+
+Shared libraries
+================
+The shared msticker saves its tick length to EEPROM_MS_TICK_COUNT_U16 through the shared eeprom library, straight to
+the hardware. Nothing here saves to that address so the write behind never overwrites it, but the shared write must not
+start while one of these is in progress: EepromThisWaitForWrite is called before anything which can make msticker save.
+A write started here reads the eeprom first, which waits for any shared write, so the other way round is safe.
+*/
+#define QUEUE_SIZE 16
+
+struct queued
+{
+    uint16_t address;
+    uint8_t  value;
+};
+
+static uint8_t       _shadow[EEPROM_SHADOW_SIZE];
+static uint8_t       _dirty [EEPROM_SHADOW_SIZE / 8];
+static struct queued _queue [QUEUE_SIZE];
+static uint8_t       _queueHead  = 0;
+static uint8_t       _queueCount = 0;
+static volatile char _isWriting  = 0; //Set when a write is started; cleared by the write complete interrupt
+
+static uint8_t readHardware(uint16_t address)
+{
+    while (EECON1bits.WR);
+    EEADRH = (uint8_t)(address >> 8);
+    EEADR  = (uint8_t)address;
+    EECON1bits.EEPGD = 0;
+    EECON1bits.CFGS  = 0;
+    EECON1bits.RD    = 1;
+    return EEDATA;
+}
+static char startWrite(uint16_t address, uint8_t value) //Returns 0 if the byte already holds the value
+{
+    if (readHardware(address) == value) return 0;
+    EEDATA = value;                 //Address was set by the read
+    EECON1bits.WREN = 1;
+    _isWriting = 1;
+    char gie = GIE;
+    GIE = 0;
+    EECON2 = 0x55;
+    EECON2 = 0xAA;
+    EECON1bits.WR = 1;
+    GIE = gie;
+    EECON1bits.WREN = 0;
+    return 1;
+}
+static void waitForWrite()
+{
+    while (EECON1bits.WR);
+    _isWriting = 0;                 //In case interrupts are not enabled yet
+}
+
+static char takeDirty(uint16_t* pAddress)
+{
+    for (uint8_t i = 0; i < sizeof(_dirty); i++)
+    {
+        uint8_t bits = _dirty[i];
+        if (!bits) continue;
+        uint8_t bit = 0;
+        while (!(bits & 1)) { bits >>= 1; bit++; }
+        _dirty[i] &= ~(1 << bit);
+        *pAddress = ((uint16_t)i << 3) + bit;
+        return 1;
+    }
+    return 0;
+}
+static char takeQueued(uint16_t* pAddress, uint8_t* pValue)
+{
+    if (!_queueCount) return 0;
+    *pAddress = _queue[_queueHead].address;
+    *pValue   = _queue[_queueHead].value;
+    _queueHead++;
+    if (_queueHead >= QUEUE_SIZE) _queueHead = 0;
+    _queueCount--;
+    return 1;
+}
+static char writeNext() //Returns 0 when there is nothing left to write
+{
+    while (1)
+    {
+        uint16_t address;
+        uint8_t  value;
+        if      (takeDirty (&address))         value = _shadow[address];
+        else if (!takeQueued(&address, &value)) return 0;
+        if (startWrite(address, value)) return 1;
+    }
+}
+
+void EepromThisSaveU8(uint16_t address, uint8_t value)
+{
+    if (address < EEPROM_SHADOW_SIZE)
+    {
+        if (_shadow[address] == value) return;
+        _shadow[address] = value;
+        _dirty[address >> 3] |= 1 << (address & 7);
+        return;
+    }
+    while (_queueCount >= QUEUE_SIZE) //Dirty shadow bytes go first so this may take more than one write
+    {
+        waitForWrite();
+        writeNext();
+    }
+    uint8_t tail = _queueHead + _queueCount;
+    if (tail >= QUEUE_SIZE) tail -= QUEUE_SIZE;
+    _queue[tail].address = address;
+    _queue[tail].value   = value;
+    _queueCount++;
+}
+uint8_t EepromThisReadU8(uint16_t address)
+{
+    if (address < EEPROM_SHADOW_SIZE) return _shadow[address];
+    for (uint8_t i = _queueCount; i > 0; i--) //Newest first
+    {
+        uint8_t index = _queueHead + i - 1;
+        if (index >= QUEUE_SIZE) index -= QUEUE_SIZE;
+        if (_queue[index].address == address) return _queue[index].value;
+    }
+    return readHardware(address);
+}
+
+void     EepromThisSaveS8  (uint16_t address,  int8_t  value) { EepromThisSaveU8(address, (uint8_t)value); }
+void     EepromThisSaveChar(uint16_t address,    char  value) { EepromThisSaveU8(address, (uint8_t)value); }
+void     EepromThisSaveU16 (uint16_t address, uint16_t value) { EepromThisSaveU8(address, (uint8_t)value); EepromThisSaveU8(address + 1, (uint8_t)(value >> 8)); }
+void     EepromThisSaveS16 (uint16_t address,  int16_t value) { EepromThisSaveU16(address, (uint16_t)value); }
+int8_t   EepromThisReadS8  (uint16_t address) { return (int8_t)EepromThisReadU8(address); }
+char     EepromThisReadChar(uint16_t address) { return (char  )EepromThisReadU8(address); }
+uint16_t EepromThisReadU16 (uint16_t address) { return EepromThisReadU8(address) | ((uint16_t)EepromThisReadU8(address + 1) << 8); }
+int16_t  EepromThisReadS16 (uint16_t address) { return (int16_t)EepromThisReadU16(address); }
+
+void EepromThisFlush()
+{
+    while (1)
+    {
+        waitForWrite();
+        if (!writeNext()) return;
+    }
+}
+void EepromThisWaitForWrite()
+{
+    waitForWrite();
+}
+char EepromThisHadInterrupt()
+{
+    return EEIF;
+}
+void EepromThisHandleInterrupt()
+{
+    _isWriting = 0;
+    EEIF = 0;
+}
+void EepromThisInit()
+{
+    for (uint16_t address = 0; address < EEPROM_SHADOW_SIZE; address++) _shadow[address] = readHardware(address);
+    EEIF = 0;
+    EEIE = 1;
+}
+void EepromThisMain()
+{
+    if (_isWriting) return;
+    writeNext();
+}
\ No newline at end of file
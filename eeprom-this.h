@@ -1,24 +1,63 @@
+#include <stdint.h>
 
 #define EEPROM_OUTPUT_STATE_CHAR                   0 //1
 #define EEPROM_REST_VOLTAGE_SETTLE_TIME_MINS_U16   1 //2
 #define EEPROM_OUTPUT_TARGET_MODE_CHAR             3 //1
 #define EEPROM_OUTPUT_ENABLES_U8                   4 //1
 #define EEPROM_CURVE_INFLEXION_MV_S16              5 //2
-#define EEPROM_COUNT_SOC_MAS_U16                   7 //2
+#define EEPROM_COUNT_SOC_MAS_U16                   7 //2 Legacy: only read if the journal is empty
 #define EEPROM_OUTPUT_REBOUND_MV_S8                9 //1
 #define EEPROM_CURVE_INFLEXION_PERCENT_U8         10 //1
 #define EEPROM_DISPLAY_ON_TIME_U8                 11 //1
 #define EEPROM_OUTPUT_TARGET_SOC_U8               12 //1
 #define EEPROM_SPARE_13_U8                        13 //1 Spare
-#define EEPROM_MS_TICK_COUNT_U16                  14 //2
+#define EEPROM_MS_TICK_COUNT_U16                  14 //2 Written directly by the shared msticker; see eeprom-this.c
 #define EEPROM_HEATER_TARGET_TENTHS_S16           16 //2
 #define EEPROM_CAL_DIFFERENCE_MAS_S16             18 //2
 #define EEPROM_HEATER_OUTPUT_OFFSET_S8            20 //1
 #define EEPROM_HEATER_KP_U16                      21 //2
 #define EEPROM_HEATER_KI_U16                      23 //2
 #define EEPROM_CURRENT_OFFSET_MA_S16              25 //2
-#define EEPROM_COUNT_POS_PULSES_U16               27 //2
-#define EEPROM_COUNT_NEG_PULSES_U16               29 //2
-#define EEPROM_CAL_PULSE_ADJUST_MAS_S16           31 //2
+#define EEPROM_COUNT_POS_PULSES_U16               27 //2 Legacy: only read if the journal is empty
+#define EEPROM_COUNT_NEG_PULSES_U16               29 //2 Legacy: only read if the journal is empty
+#define EEPROM_CAL_PULSE_POS_ADJUST_MAS_S16       31 //2
 #define EEPROM_REST_TIMER_MINUTES_U16             33 //2
-#define EEPROM_REST_CURRENT_SETTLE_TIME_MINS_U16  35 //2
\ No newline at end of file
+#define EEPROM_REST_CURRENT_SETTLE_TIME_MINS_U16  35 //2
+#define EEPROM_VOLTAGE_MULTIPLIER_U16             37 //2
+#define EEPROM_VOLTAGE_OFFSET_MV_S16              39 //2
+#define EEPROM_OCV_RESISTANCE_UOHM_U16            41 //2
+#define EEPROM_SPARE_43_U16                       43 //2 Spare
+#define EEPROM_COUNT_CAPACITY_AH_U16              45 //2
+#define EEPROM_CAL_PULSE_NEG_ADJUST_MAS_S16       47 //2
+#define EEPROM_SOH_CAPACITY_DECI_AH_U16           49 //2
+#define EEPROM_SOH_APPLY_CHAR                     51 //1
+#define EEPROM_CURVE_TABLE                        52 //80 = 16 points of 5 bytes
+#define EEPROM_CURVE_TEMP_A_10BFDP_S16           132 //2
+#define EEPROM_CURVE_TEMP_B_10BFDP_S16           134 //2
+#define EEPROM_CAL_PULSE_STATE                   136 //44 = two slots of 22 bytes; see cal-pulse.c
+#define EEPROM_SPARE_180                         180 //53 Spare
+#define EEPROM_PREHEAT_RISE_8BFDP_U16            233 //2
+#define EEPROM_PREHEAT_LOSS_8BFDP_U16            235 //2
+
+#define EEPROM_SHADOW_SIZE                       256 //Everything below is held in ram; see eeprom-this.c
+
+#define EEPROM_JOURNAL_START                     512 //480 = 48 records of 10 bytes
+#define EEPROM_JOURNAL_RECORD_COUNT               48
+
+extern void     EepromThisSaveU8  (uint16_t address, uint8_t  value);
+extern void     EepromThisSaveS8  (uint16_t address,  int8_t  value);
+extern void     EepromThisSaveChar(uint16_t address,    char  value);
+extern void     EepromThisSaveU16 (uint16_t address, uint16_t value);
+extern void     EepromThisSaveS16 (uint16_t address,  int16_t value);
+extern uint8_t  EepromThisReadU8  (uint16_t address);
+extern int8_t   EepromThisReadS8  (uint16_t address);
+extern char     EepromThisReadChar(uint16_t address);
+extern uint16_t EepromThisReadU16 (uint16_t address);
+extern int16_t  EepromThisReadS16 (uint16_t address);
+
+extern void     EepromThisFlush(void);
+extern void     EepromThisWaitForWrite(void); //For the shared libraries which write directly
+extern char     EepromThisHadInterrupt(void);
+extern void     EepromThisHandleInterrupt(void);
+extern void     EepromThisInit(void);
+extern void     EepromThisMain(void);
\ No newline at end of file
@@ -0,0 +1,36 @@
+#include <stdint.h>
+
+#include "handoff.h"
+
+/*
+Lock free handoff from an interrupt to the main loop
+====================================================
+Sequence counted snapshot
+    The interrupt updates the shared values and then increments a single byte sequence number.
+    The main loop reads the sequence, copies the values and reads the sequence again.
+    If the sequence has changed then an interrupt has updated the values part way through the copy so it tries again.
+    An interrupt always runs to completion so the writer never needs to be protected from the reader.
+
+Single producer single consumer counters
+    The interrupt only ever increments its own byte counter and the main loop only ever increments its own.
+    The main loop has work to do while the two differ. Single byte reads and writes are atomic on this processor.
+
+Neither disables interrupts. The number of retries shows how often the main loop and an interrupt collided.
+*/
+
+static uint16_t _retries = 0;
+
+uint16_t HandoffGetRetries() { return _retries; }
+
+void HandoffRead(volatile uint8_t* pSequence, volatile void* pSource, void* pDestination, uint8_t size)
+{
+    while (1)
+    {
+        uint8_t sequence = *pSequence;
+        volatile uint8_t* pS = pSource;
+                 uint8_t* pD = pDestination;
+        for (uint8_t i = 0; i < size; i++) *pD++ = *pS++;
+        if (sequence == *pSequence) return;
+        _retries++;
+    }
+}
@@ -0,0 +1,4 @@
+#include <stdint.h>
+
+extern uint16_t HandoffGetRetries(void);
+extern void     HandoffRead(volatile uint8_t* pSequence, volatile void* pSource, void* pDestination, uint8_t size);
@@ -0,0 +1,117 @@
+#include <stdint.h>
+
+#include "../mstimer.h"
+
+#include "heater.h"
+#include "heater-tune.h"
+
+/*
+Relay auto tune
+===============
+While tuning, the heater is switched fully on below the set point and fully off above it, with a little hysteresis.
+The temperature then oscillates about the set point and, for a relay of half span d and an oscillation of half
+amplitude a, the ultimate gain and period are:
+    Ku = 4d / (pi a)    Tu = period of the oscillation
+The first SKIP_CYCLES cycles are ignored while the oscillation settles and the next MEASURE_CYCLES are averaged.
+Ziegler-Nichols then gives the PI gains:
+    Kp = 0.45 Ku        Ti = Tu / 1.2
+In the heater's units, power out of 256 per degree with 8 bit fixed decimal places on both, d is 128 and a is held in
+8bfdp so:
+    kp8bfdp = 0.45 x 4 x d x 256 x 256 / (pi x a8bfdp) = d x 37550 / a8bfdp
+The integral is added once per temperature sample, divided by 2^HEATER_INTEGRAL_SHIFT, so with Ts the sample period:
+    ki8bfdp = kp8bfdp x Ts x 2^HEATER_INTEGRAL_SHIFT / Ti = kp8bfdp x 1.2 x Ts x 2^HEATER_INTEGRAL_SHIFT / Tu
+Ts is measured over the run rather than assumed. The hysteresis is small enough next to a to be ignored.
+The run fails if it takes longer than MAX_TIME_MS or the oscillation is lost in the noise.
+*/
+#define RELAY_ON            255
+#define RELAY_OFF             0
+#define RELAY_HALF_SPAN     128
+#define HYSTERESIS_8BFDP     13     //0.05 degree
+#define SKIP_CYCLES           1
+#define MEASURE_CYCLES        3
+#define MIN_AMPLITUDE_8BFDP   8     //1/32 degree
+#define MAX_TIME_MS          24UL * 3600 * 1000
+
+static char     _state          = HEATER_TUNE_IDLE;
+static char     _relayIsOn      = 0;
+static uint8_t  _switches       = 0;
+static uint32_t _samples        = 0;
+static int16_t  _max8bfdp       = 0;
+static int16_t  _min8bfdp       = 0;
+static uint32_t _msStart        = 0;
+static uint32_t _msCycleStart   = 0;
+static uint32_t _totalPeriodMs  = 0;
+static int32_t  _totalAmplitude8bfdp = 0;
+static uint16_t _periodMins     = 0;
+static int16_t  _amplitude8bfdp = 0;
+
+char     HeaterTuneGetState         () { return _state;          }
+char     HeaterTuneGetIsRunning     () { return _state == HEATER_TUNE_RUNNING; }
+uint16_t HeaterTuneGetPeriodMins    () { return _periodMins;     }
+int16_t  HeaterTuneGetAmplitude8bfdp() { return _amplitude8bfdp; }
+
+void HeaterTuneStart()
+{
+    _state               = HEATER_TUNE_RUNNING;
+    _switches            = 0;
+    _samples             = 0;
+    _msStart             = MsTimerCount;
+    _totalPeriodMs       = 0;
+    _totalAmplitude8bfdp = 0;
+    _relayIsOn           = 0; //Decided by the first sample
+    _max8bfdp            = INT16_MIN;
+    _min8bfdp            = INT16_MAX;
+}
+void HeaterTuneStop()
+{
+    if (_state == HEATER_TUNE_RUNNING) _state = HEATER_TUNE_IDLE;
+}
+
+static void finish()
+{
+    int32_t  a8bfdp = _totalAmplitude8bfdp / MEASURE_CYCLES;
+    uint32_t tuMs   = _totalPeriodMs       / MEASURE_CYCLES;
+    uint32_t tsMs   = ((MsTimerCount - _msStart) << 4) / _samples << (HEATER_INTEGRAL_SHIFT - 4); //Times 2^shift in two steps to stay within 32 bits
+    _amplitude8bfdp = (int16_t)a8bfdp;
+    _periodMins     = (uint16_t)(tuMs / 60000);
+    if (a8bfdp < MIN_AMPLITUDE_8BFDP || tuMs < 60000) { _state = HEATER_TUNE_FAILED; return; }
+    
+    uint32_t kp = (uint32_t)RELAY_HALF_SPAN * 37550 / (uint32_t)a8bfdp;
+    if (kp > UINT16_MAX) kp = UINT16_MAX;
+    uint32_t ki = kp * 12 / 10 * (tsMs / 100) / (tuMs / 100); //In tenths of a second to keep within 32 bits
+    if (ki > UINT16_MAX) ki = UINT16_MAX;
+    
+    HeaterSetKp8bfdp((uint16_t)kp);
+    HeaterSetKi8bfdp((uint16_t)ki);
+    _state = HEATER_TUNE_DONE;
+}
+uint8_t HeaterTuneAddSample(int16_t sp8bfdp, int16_t pv8bfdp) //Returns the heater output
+{
+    if (MsTimerRelative(_msStart, MAX_TIME_MS)) { _state = HEATER_TUNE_FAILED; return RELAY_OFF; }
+    
+    if (!_samples) _relayIsOn = pv8bfdp < sp8bfdp;
+    _samples++;
+    if (pv8bfdp > _max8bfdp) _max8bfdp = pv8bfdp;
+    if (pv8bfdp < _min8bfdp) _min8bfdp = pv8bfdp;
+    
+    if ( _relayIsOn && pv8bfdp > sp8bfdp + HYSTERESIS_8BFDP) _relayIsOn = 0;
+    if (!_relayIsOn && pv8bfdp < sp8bfdp - HYSTERESIS_8BFDP)
+    {
+        _relayIsOn = 1; //A cycle runs from one switch on to the next
+        if (_switches > SKIP_CYCLES)
+        {
+            _totalPeriodMs       += MsTimerCount - _msCycleStart;
+            _totalAmplitude8bfdp += (_max8bfdp - _min8bfdp) / 2;
+        }
+        _switches++;
+        _msCycleStart = MsTimerCount;
+        _max8bfdp     = pv8bfdp;
+        _min8bfdp     = pv8bfdp;
+        if (_switches > SKIP_CYCLES + MEASURE_CYCLES)
+        {
+            finish();
+            return RELAY_OFF;
+        }
+    }
+    return _relayIsOn ? RELAY_ON : RELAY_OFF;
+}
\ No newline at end of file
@@ -0,0 +1,15 @@
+#include <stdint.h>
+
+#define HEATER_TUNE_IDLE    0
+#define HEATER_TUNE_RUNNING 'R'
+#define HEATER_TUNE_DONE    'D'
+#define HEATER_TUNE_FAILED  'F'
+
+extern char     HeaterTuneGetState(void);
+extern char     HeaterTuneGetIsRunning(void);
+extern uint16_t HeaterTuneGetPeriodMins(void);
+extern int16_t  HeaterTuneGetAmplitude8bfdp(void);
+
+extern void     HeaterTuneStart(void);
+extern void     HeaterTuneStop(void);
+extern uint8_t  HeaterTuneAddSample(int16_t sp8bfdp, int16_t pv8bfdp);
\ No newline at end of file
@@ -1,9 +1,11 @@
 #include <xc.h>
 #include "../mstimer.h"
-#include "../eeprom.h"
 
+#include "heater.h"
 #include "temperature.h"
 #include "eeprom-this.h"
+#include "heater-tune.h"
+#include "preheat.h"
 
  int16_t _targetTenths         = 0;
 uint16_t  _kp8bfdp             = 0;
@@ -30,6 +32,9 @@ uint8_t  _power0to255          = 0;
   Integral     output (sum(error x ki)) power               as a    signed 24bit with a 16 bit fixed decimal point DDDD FFFF FFFF
   Output                                power               as an unsigned  8bit 0-255, 0-100% 0-22W               DDDD
   
+  The loop runs on every temperature sample, every 250ms. The integral is scaled down by 2^HEATER_INTEGRAL_SHIFT = 256
+  so ki keeps its meaning of the gain over 256 samples, the 64 seconds between samples before the filter was changed.
+  
  */
 
 int16_t  HeaterGetTargetTenths () { return _targetTenths; }
@@ -39,9 +44,9 @@ uint8_t  HeaterGetOutputFixed  () { return _power0to255; }
 uint16_t HeaterGetKp8bfdp      () { return _kp8bfdp; }
 uint16_t HeaterGetKi8bfdp      () { return _ki8bfdp; }
 
-void HeaterSetTargetTenths(int16_t  value) { _targetTenths = value; EepromSaveS16(EEPROM_HEATER_TARGET_TENTHS_S16, value); }
-void HeaterSetKp8bfdp     (uint16_t value) { _kp8bfdp      = value; EepromSaveU16(EEPROM_HEATER_KP_U16           , value); }
-void HeaterSetKi8bfdp     (uint16_t value) { _ki8bfdp      = value; EepromSaveU16(EEPROM_HEATER_KI_U16           , value); }
+void HeaterSetTargetTenths(int16_t  value) { _targetTenths = value; EepromThisSaveS16(EEPROM_HEATER_TARGET_TENTHS_S16, value); }
+void HeaterSetKp8bfdp     (uint16_t value) { _kp8bfdp      = value; EepromThisSaveU16(EEPROM_HEATER_KP_U16           , value); }
+void HeaterSetKi8bfdp     (uint16_t value) { _ki8bfdp      = value; EepromThisSaveU16(EEPROM_HEATER_KI_U16           , value); }
 
 void HeaterInit(void)
 {
@@ -52,10 +57,10 @@ void HeaterInit(void)
     PR2 = 0x3F; //Set Timer 2 preset compare to 6 of the 8 bits
     TMR2ON = 1; //Turn on Timer 2
     
-    _targetTenths         =          EepromReadS16(EEPROM_HEATER_TARGET_TENTHS_S16);
-    _kp8bfdp              =          EepromReadU16(EEPROM_HEATER_KP_U16           );
-    _ki8bfdp              =          EepromReadU16(EEPROM_HEATER_KI_U16           );
-    _integralOutput16bfdp = (int32_t)EepromReadS8 (EEPROM_HEATER_OUTPUT_OFFSET_S8 ) * 256 * 256;
+    _targetTenths         =          EepromThisReadS16(EEPROM_HEATER_TARGET_TENTHS_S16);
+    _kp8bfdp              =          EepromThisReadU16(EEPROM_HEATER_KP_U16           );
+    _ki8bfdp              =          EepromThisReadU16(EEPROM_HEATER_KI_U16           );
+    _integralOutput16bfdp = (int32_t)EepromThisReadS8 (EEPROM_HEATER_OUTPUT_OFFSET_S8 ) * 256 * 256;
 }
 static const uint8_t _sqrt[] = {
     0, 16, 23, 28, 32, 36, 39, 42, 45, 48, 51, 53, 55, 58, 60, 62,
@@ -90,6 +95,15 @@ void HeaterMain(void)
     if (!TemperatureSampleIsReadyForUseByHeater) return;
     TemperatureSampleIsReadyForUseByHeater = 0;
     
+    //Let the auto tune drive the output while it runs
+    if (HeaterTuneGetIsRunning())
+    {
+        _power0to255 = HeaterTuneAddSample(TemperatureConvertTenthsTo8bfdp(_targetTenths), TemperatureGetAs8bfdp());
+        setPwmDutyCycle(_sqrt[_power0to255]);
+        PreheatAddEnergy(_power0to255); //The relay output is not a model sample but still uses energy
+        return;
+    }
+    
     //static uint32_t msTimerIntegralDo   = 0;
     static uint32_t msTimerIntegralSave = 0;
     //char doIntegral   = MsTimerRepetitive(&msTimerIntegralDo  ,  60000); //Every minute
@@ -97,15 +111,28 @@ void HeaterMain(void)
     
     //if (!doIntegral) return;
     
-    int16_t sp8bfdp    = TemperatureConvertTenthsTo8bfdp(_targetTenths);
+    int16_t targetTenths = _targetTenths;
+    if (PreheatGetIsActive() && PreheatGetTargetTenths() > targetTenths) targetTenths = PreheatGetTargetTenths();
+    int16_t sp8bfdp    = TemperatureConvertTenthsTo8bfdp(targetTenths);
     int16_t pv8bfdp    = TemperatureGetAs8bfdp();
     int16_t error8bfdp = sp8bfdp - pv8bfdp;
+    
+    //Feed forward: step the integral by the learnt power per degree when the set point moves
+    static int16_t lastSp8bfdp = 0;
+    static char    hadSp       = 0;
+    if (hadSp && sp8bfdp != lastSp8bfdp) _integralOutput16bfdp += (int32_t)(sp8bfdp - lastSp8bfdp) * PreheatGetLoss8bfdp();
+    lastSp8bfdp = sp8bfdp;
+    hadSp       = 1;
 
     //Proportional
     int32_t      proportionalOutput16bfdp  = (int32_t)error8bfdp * _kp8bfdp;
 
-    //Integral
-    _integralOutput16bfdp += (int32_t)error8bfdp * _ki8bfdp;
+    //Integral - there is a sample every 250ms so each adds 1/2^HEATER_INTEGRAL_SHIFT, keeping the remainder for next time
+    static int32_t integralRemainder = 0;
+    int32_t integralStep = (int32_t)error8bfdp * _ki8bfdp + integralRemainder;
+    int32_t integralAdd  = integralStep >> HEATER_INTEGRAL_SHIFT;
+    integralRemainder    = integralStep - (integralAdd << HEATER_INTEGRAL_SHIFT);
+    _integralOutput16bfdp += integralAdd;
     
     //Output
     int32_t output16bfdp = proportionalOutput16bfdp + _integralOutput16bfdp;
@@ -116,7 +143,8 @@ void HeaterMain(void)
     //Set duty cycle
     _power0to255 = (uint8_t)(output16bfdp / 256 / 256 + 128); //-128 + 128 = 0; 127 + 128 = 255
     setPwmDutyCycle(_sqrt[_power0to255]);
+    PreheatAddSample(sp8bfdp, pv8bfdp, _power0to255);
     
     //Save integral
-    if (saveIntegral) EepromSaveS8(EEPROM_HEATER_OUTPUT_OFFSET_S8, (int8_t)(_integralOutput16bfdp / 256 / 256));
+    if (saveIntegral) EepromThisSaveS8(EEPROM_HEATER_OUTPUT_OFFSET_S8, (int8_t)(_integralOutput16bfdp / 256 / 256));
 }
\ No newline at end of file
@@ -13,5 +13,7 @@ extern void     HeaterSetKp8bfdp(uint16_t value);
 extern uint16_t HeaterGetKi8bfdp(void);
 extern void     HeaterSetKi8bfdp(uint16_t value);
 
+#define HEATER_INTEGRAL_SHIFT 8 //The integral is added each sample divided by 2^this
+
 extern void HeaterInit(void);
 extern void HeaterMain(void);
\ No newline at end of file
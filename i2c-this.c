@@ -0,0 +1,200 @@
+#include <stdint.h>
+#include <xc.h>
+
+#include "../mstimer.h"
+
+#include "i2c-this.h"
+
+/*
+Interrupt driven transactions
+=============================
+A transaction sends some bytes to a device, then optionally reads some back after a repeated start. The caller owns
+the descriptor, submits it and then polls its status; nothing is called back from the interrupt.
+The MSSP interrupt steps through each start, byte, acknowledge and stop so the main loop never waits on the bus.
+Submitted transactions are held in a small queue and the one with the lowest priority number goes next.
+
+Every device goes through the queue: the temperature sensor and the lcd in lcd-this.c. The interrupt is only enabled
+while a transaction is in progress.
+
+Recovery
+========
+After a bus collision, or a transaction taking longer than TIMEOUT_MS, the transaction fails and a stop is sent; the next
+transaction is only started from the stop's own interrupt so a start never follows a stop before the bus is free.
+If the module is still busy with a byte or condition it would ignore the stop, and if the stop does not complete within
+TIMEOUT_MS either the bus is stuck: in both cases the module is reset and the queue carries on.
+*/
+#define QUEUE_SIZE 4
+#define TIMEOUT_MS 50
+
+#define STEP_START     0
+#define STEP_ADDRESS   1
+#define STEP_SEND      2
+#define STEP_RESTART   3
+#define STEP_RECEIVE   4
+#define STEP_ACK       5
+#define STEP_STOP      6
+
+static struct I2CThisTransaction* volatile _queue[QUEUE_SIZE];
+static struct I2CThisTransaction* volatile _pCurrent = 0;
+static volatile uint8_t _step    = STEP_START;
+static volatile uint8_t _index   = 0;
+static volatile char    _reading = 0;
+static volatile char    _failed  = 0;
+static volatile uint32_t _msStarted = 0; //Written by the interrupt so only trusted with it disabled
+
+char I2CThisIsIdle()
+{
+    if (_pCurrent) return 0;
+    for (uint8_t i = 0; i < QUEUE_SIZE; i++) if (_queue[i]) return 0;
+    return 1;
+}
+
+static void startNext() //Called with the interrupt disabled or from the interrupt
+{
+    int8_t best = -1;
+    for (uint8_t i = 0; i < QUEUE_SIZE; i++)
+    {
+        if (!_queue[i]) continue;
+        if (best < 0 || _queue[i]->priority < _queue[best]->priority) best = i;
+    }
+    if (best < 0)
+    {
+        _pCurrent = 0;
+        SSPIE = 0;
+        return;
+    }
+    _pCurrent = _queue[best];
+    _queue[best] = 0;
+    _step    = STEP_START;
+    _index   = 0;
+    _reading = !_pCurrent->sendLength;
+    _failed  = 0;
+    _msStarted = MsTimerCount;
+    SSPIF = 0;
+    SSPIE = 1;
+    SSPCON2bits.SEN = 1;
+}
+static void stop(char failed)
+{
+    _failed = failed;
+    _step = STEP_STOP;
+    SSPCON2bits.PEN = 1;
+}
+static void recover() //Called with the interrupt disabled or from the interrupt
+{
+    _msStarted = MsTimerCount; //The stop gets its own timeout
+    SSPIF = 0;
+    stop(1);
+    SSPIE = 1;
+}
+
+char I2CThisSubmit(struct I2CThisTransaction* pTransaction)
+{
+    char wasEnabled = SSPIE;
+    SSPIE = 0;
+    char ok = 0;
+    for (uint8_t i = 0; i < QUEUE_SIZE; i++)
+    {
+        if (_queue[i]) continue;
+        _queue[i] = pTransaction;
+        pTransaction->status = I2C_THIS_PENDING;
+        ok = 1;
+        break;
+    }
+    if (!_pCurrent) startNext();
+    else            SSPIE = wasEnabled;
+    return ok;
+}
+
+char I2CThisHadInterrupt()
+{
+    return SSPIE && (SSPIF || BCLIF);
+}
+void I2CThisHandleInterrupt()
+{
+    SSPIF = 0;
+    if (BCLIF)
+    {
+        BCLIF = 0;
+        recover();
+        return;
+    }
+    struct I2CThisTransaction* p = _pCurrent;
+    switch (_step)
+    {
+        case STEP_START:
+            SSPBUF = (uint8_t)(p->address << 1) | _reading;
+            _step = STEP_ADDRESS;
+            break;
+        case STEP_ADDRESS:
+            if (SSPCON2bits.ACKSTAT) { stop(1); break; }
+            if (_reading)
+            {
+                _index = 0;
+                SSPCON2bits.RCEN = 1;
+                _step = STEP_RECEIVE;
+                break;
+            }
+            SSPBUF = p->pSend[_index++];
+            _step = STEP_SEND;
+            break;
+        case STEP_SEND:
+            if (SSPCON2bits.ACKSTAT) { stop(1); break; }
+            if (_index < p->sendLength)
+            {
+                SSPBUF = p->pSend[_index++];
+                break;
+            }
+            if (p->receiveLength)
+            {
+                _reading = 1;
+                SSPCON2bits.RSEN = 1;
+                _step = STEP_RESTART;
+                break;
+            }
+            stop(0);
+            break;
+        case STEP_RESTART:
+            SSPBUF = (uint8_t)(p->address << 1) | 1;
+            _step = STEP_ADDRESS;
+            break;
+        case STEP_RECEIVE:
+            p->pReceive[_index++] = SSPBUF;
+            SSPCON2bits.ACKDT = _index >= p->receiveLength; //Not acknowledging the last byte tells the device to stop sending
+            SSPCON2bits.ACKEN = 1;
+            _step = STEP_ACK;
+            break;
+        case STEP_ACK:
+            if (_index < p->receiveLength)
+            {
+                SSPCON2bits.RCEN = 1;
+                _step = STEP_RECEIVE;
+                break;
+            }
+            stop(0);
+            break;
+        case STEP_STOP:
+            p->status = _failed ? I2C_THIS_FAILED : I2C_THIS_DONE;
+            startNext();
+            break;
+    }
+}
+
+void I2CThisMain()
+{
+    if (!_pCurrent) return;
+    if (!MsTimerRelative(_msStarted, TIMEOUT_MS)) return;
+    SSPIE = 0;
+    if (!_pCurrent) return; //Finished just now
+    if (!MsTimerRelative(_msStarted, TIMEOUT_MS)) { SSPIE = 1; return; } //The next one started just now
+    char busy = SSPCON2bits.SEN || SSPCON2bits.RSEN || SSPCON2bits.PEN || SSPCON2bits.RCEN || SSPCON2bits.ACKEN || SSPSTATbits.R_W; //R_W is set while a byte is sent
+    if (!busy && _step != STEP_STOP)
+    {
+        recover();
+        return;
+    }
+    SSPCON1bits.SSPEN = 0; //A stop would be ignored while the module is busy, or even the stop did not complete, so reset the module
+    SSPCON1bits.SSPEN = 1;
+    _pCurrent->status = I2C_THIS_FAILED;
+    startNext();
+}
\ No newline at end of file
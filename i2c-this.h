@@ -1,4 +1,31 @@
+#include <stdint.h>
 
 #define I2C_ADDRESS_LCD     0x3F
 #define I2C_ADDRESS_LM75A   0x48
-#define I2C_ADDRESS_ADT7410 0x48
\ No newline at end of file
+#define I2C_ADDRESS_ADT7410 0x48
+
+#define I2C_THIS_IDLE    0
+#define I2C_THIS_PENDING 1
+#define I2C_THIS_DONE    2
+#define I2C_THIS_FAILED  3
+
+#define I2C_THIS_PRIORITY_TEMPERATURE 0 //Lower goes first
+#define I2C_THIS_PRIORITY_LCD         1
+
+struct I2CThisTransaction
+{
+    uint8_t          address;
+    uint8_t          priority;
+    uint8_t          sendLength;
+    uint8_t          receiveLength; //Read after a repeated start; zero for none
+    const uint8_t*   pSend;
+    uint8_t*         pReceive;
+    volatile uint8_t status;
+};
+
+extern char I2CThisSubmit(struct I2CThisTransaction* pTransaction); //Returns 0 if the queue is full
+extern char I2CThisIsIdle(void);
+
+extern char I2CThisHadInterrupt(void);
+extern void I2CThisHandleInterrupt(void);
+extern void I2CThisMain(void);
\ No newline at end of file
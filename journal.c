@@ -0,0 +1,109 @@
+#include <stdint.h>
+
+#include "eeprom-this.h"
+#include "journal.h"
+
+/*
+Journal
+=======
+The counts are saved to a ring of records rather than to fixed addresses so the wear is spread across the ring.
+Each record is:
+    sequence        1 byte - written last
+    record          8 bytes
+    crc             1 byte
+A record torn by a reset fails its crc and the previous one is used. One time in 256 a torn record will pass by chance,
+so the sequence is written last: until then the slot keeps the sequence of the record it is replacing, the oldest in the
+ring, and so can never be taken for the newest.
+
+The sequence goes up by one for each record written and wraps at 256. As the ring holds far fewer than 128 records
+the newest valid record is the one which no other valid record is ahead of.
+
+Wear
+====
+The eeprom is good for 1 million writes per byte. A record is rewritten once every JOURNAL_RECORD_COUNT saves so:
+    saves over 20 years = 1 million x 48 = 48 million
+    20 years            = 20 x 365 x 24 x 3600 = 631 million seconds
+    shortest save gap   = 631 / 48 = 13 seconds
+Unchanged bytes, such as the top of the charge and the pulse counts, are not rewritten by EepromThisSaveU8 and so wear less.
+*/
+#define RECORD_SIZE (1 + sizeof(struct JournalRecord) + 1)
+
+static uint8_t _next     = 0; //Slot to be written next
+static uint8_t _sequence = 0; //Sequence of the next record
+
+static uint16_t getAddress(uint8_t slot) { return EEPROM_JOURNAL_START + (uint16_t)slot * RECORD_SIZE; }
+
+static uint8_t addCrc(uint8_t crc, uint8_t byte) //CRC-8 polynomial 0x07
+{
+    crc ^= byte;
+    for (uint8_t i = 0; i < 8; i++) crc = crc & 0x80 ? (uint8_t)(crc << 1) ^ 0x07 : (uint8_t)(crc << 1);
+    return crc;
+}
+static char readSlot(uint8_t slot, uint8_t* pSequence, struct JournalRecord* pRecord) //Returns 0 if the slot is not valid
+{
+    uint16_t address = getAddress(slot);
+    uint8_t* p = (uint8_t*)pRecord;
+    
+    uint8_t crc = 0xFF;
+    *pSequence = EepromThisReadU8(address++);
+    crc = addCrc(crc, *pSequence);
+    for (uint8_t i = 0; i < sizeof(struct JournalRecord); i++)
+    {
+        p[i] = EepromThisReadU8(address++);
+        crc = addCrc(crc, p[i]);
+    }
+    return crc == EepromThisReadU8(address);
+}
+static char findNewest(uint8_t* pSlot, uint8_t* pSequence, struct JournalRecord* pRecord)
+{
+    char found = 0;
+    for (uint8_t slot = 0; slot < EEPROM_JOURNAL_RECORD_COUNT; slot++)
+    {
+        uint8_t sequence;
+        struct JournalRecord record;
+        if (!readSlot(slot, &sequence, &record)) continue;
+        if (found && (int8_t)(sequence - *pSequence) <= 0) continue;
+        found      = 1;
+        *pSlot     = slot;
+        *pSequence = sequence;
+        *pRecord   = record;
+    }
+    return found;
+}
+char JournalRead(struct JournalRecord* pRecord)
+{
+    uint8_t slot;
+    uint8_t sequence;
+    return findNewest(&slot, &sequence, pRecord);
+}
+void JournalWrite(struct JournalRecord* pRecord)
+{
+    uint16_t address = getAddress(_next);
+    uint8_t* p = (uint8_t*)pRecord;
+    
+    uint8_t crc = 0xFF;
+    crc = addCrc(crc, _sequence);
+    for (uint8_t i = 0; i < sizeof(struct JournalRecord); i++)
+    {
+        EepromThisSaveU8(address + 1 + i, p[i]);
+        crc = addCrc(crc, p[i]);
+    }
+    EepromThisSaveU8(address + 1 + sizeof(struct JournalRecord), crc);
+    EepromThisSaveU8(address, _sequence);
+    
+    _sequence++;
+    _next++;
+    if (_next >= EEPROM_JOURNAL_RECORD_COUNT) _next = 0;
+}
+void JournalInit()
+{
+    uint8_t slot;
+    uint8_t sequence;
+    struct JournalRecord record;
+    if (findNewest(&slot, &sequence, &record))
+    {
+        _next = slot + 1;
+        if (_next >= EEPROM_JOURNAL_RECORD_COUNT) _next = 0;
+        _sequence = sequence + 1;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,13 @@
+#include <stdint.h>
+
+struct JournalRecord
+{
+    uint32_t milliAmpSeconds;
+    uint16_t posPulses;
+    uint16_t negPulses;
+};
+
+extern char JournalRead (struct JournalRecord* pRecord); //Returns 0 if there is no valid record
+extern void JournalWrite(struct JournalRecord* pRecord);
+
+extern void JournalInit(void);
\ No newline at end of file
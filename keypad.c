@@ -13,10 +13,7 @@
 #define REPEAT_MS      200
 #define DEBOUNCE_MS     50
 
-static char _pressed1   = 0;
-static char _pressed2   = 0;
-static char _pressed3   = 0;
-static char _pressed4   = 0;
+static volatile uint8_t _pressed = 0; //Bit 0 = key 1 to bit 3 = key 4; written whole by the tick handler so the main loop always reads a consistent set
 
 char KeypadMultiplier = 0; //0 = 1; 1 = 10; 2 = 100; 3 = 1000
 char KeypadOneShot    = 0;
@@ -27,26 +24,29 @@ void KeypadTickHandler()
     static int8_t debounceMs2 = 0;
     static int8_t debounceMs3 = 0;
     static int8_t debounceMs4 = 0;
+    static uint8_t pressed = 0;
 
     if (!KP1 && debounceMs1 <  DEBOUNCE_MS) debounceMs1++;
     if ( KP1 && debounceMs1 >            0) debounceMs1--;
-    if (        debounceMs1 == 0          ) _pressed1 = 0;
-    if (        debounceMs1 == DEBOUNCE_MS) _pressed1 = 1;
+    if (        debounceMs1 == 0          ) pressed &= ~1;
+    if (        debounceMs1 == DEBOUNCE_MS) pressed |=  1;
     
     if (!KP2 && debounceMs2 <  DEBOUNCE_MS) debounceMs2++;
     if ( KP2 && debounceMs2 >            0) debounceMs2--;
-    if (        debounceMs2 == 0          ) _pressed2 = 0;
-    if (        debounceMs2 == DEBOUNCE_MS) _pressed2 = 1;
+    if (        debounceMs2 == 0          ) pressed &= ~2;
+    if (        debounceMs2 == DEBOUNCE_MS) pressed |=  2;
     
     if (!KP3 && debounceMs3 <  DEBOUNCE_MS) debounceMs3++;
     if ( KP3 && debounceMs3 >            0) debounceMs3--;
-    if (        debounceMs3 == 0          ) _pressed3 = 0;
-    if (        debounceMs3 == DEBOUNCE_MS) _pressed3 = 1;
+    if (        debounceMs3 == 0          ) pressed &= ~4;
+    if (        debounceMs3 == DEBOUNCE_MS) pressed |=  4;
     
     if (!KP4 && debounceMs4 <  DEBOUNCE_MS) debounceMs4++;
     if ( KP4 && debounceMs4 >            0) debounceMs4--;
-    if (        debounceMs4 == 0          ) _pressed4 = 0;
-    if (        debounceMs4 == DEBOUNCE_MS) _pressed4 = 1;
+    if (        debounceMs4 == 0          ) pressed &= ~8;
+    if (        debounceMs4 == DEBOUNCE_MS) pressed |=  8;
+    
+    _pressed = pressed;
 }
 
 void KeypadMain()
@@ -59,10 +59,11 @@ void KeypadMain()
     static uint32_t msTimerPreRepeat = 0;
     static uint32_t msTimerMultiply = 0;
     
-    char kp1 = _pressed1;
-    char kp2 = _pressed2;
-    char kp3 = _pressed3;
-    char kp4 = _pressed4;
+    uint8_t pressed = _pressed;
+    char kp1 = pressed & 1;
+    char kp2 = pressed & 2;
+    char kp3 = pressed & 4;
+    char kp4 = pressed & 8;
     
     KeypadOneShot = 0;
     if (kp1 && !kpWasPressed1) KeypadOneShot |= 1;
@@ -0,0 +1,150 @@
+#include <stdint.h>
+
+#include "../mstimer.h"
+
+#include "i2c-this.h"
+#include "lcd-this.h"
+
+/*
+1602 lcd
+========
+The lcd is an HD44780 in 4 bit mode behind a PCF8574 expander:
+    P0 = RS, P1 = RW, P2 = E, P3 = backlight, P4 to P7 = D4 to D7
+Each nibble is two expander bytes, the first with E high and the second with it low, so a byte to the lcd is four bytes on
+the bus. At 100kHz each expander byte takes 90us which is longer than any command other than clear and home, so they
+can follow each other with no waits.
+
+Rather than the shared lcd library, which polls the bus, everything goes through the interrupt driven queue in i2c-this.c
+at I2C_THIS_PRIORITY_LCD so the temperature reads go first. A whole line, its address and 16 characters, is one
+transaction of 68 bytes. A failed transaction is sent again.
+
+Initialisation follows the HD44780 data sheet for an unknown state: three 8 bit function sets then a switch to 4 bit,
+each followed by its wait. A wait is timed from when its transaction is done, plus one to allow for the millisecond tick.
+*/
+#define PIN_RS        0x01
+#define PIN_E         0x04
+#define PIN_BACKLIGHT 0x08
+
+#define POWER_UP_MS 50
+
+#define LINE_LENGTH 16
+#define BUFFER_SIZE (4 * (1 + LINE_LENGTH))
+
+#define COMMAND_DISPLAY_OFF 0x08
+#define COMMAND_DISPLAY_ON  0x0C
+#define COMMAND_ADDRESS     0x80 //Or'd with the ddram address
+#define LINE_1_ADDRESS      0x40
+
+struct initStep
+{
+    uint8_t value;
+    uint8_t nibbleOnly;
+    uint8_t waitMs;
+};
+static const struct initStep _initSteps[] =
+{
+    { 0x30, 1, 5 }, //Function set 8 bit
+    { 0x30, 1, 1 },
+    { 0x30, 1, 1 },
+    { 0x20, 1, 1 }, //Function set 4 bit
+    { 0x28, 0, 1 }, //Function set 4 bit, 2 lines, 5 x 8 font
+    { COMMAND_DISPLAY_OFF, 0, 1 },
+    { 0x01, 0, 2 }, //Clear takes 1.52ms
+    { 0x06, 0, 1 }, //Entry mode increment, no shift
+};
+#define INIT_STEP_COUNT (sizeof(_initSteps) / sizeof(_initSteps[0]))
+
+static uint8_t _buffer[BUFFER_SIZE];
+static uint8_t _length = 0;
+static struct I2CThisTransaction _transaction = { 0, I2C_THIS_PRIORITY_LCD, 0, 0, _buffer, 0, I2C_THIS_IDLE };
+
+static uint8_t  _initStep   = 0;
+static uint32_t _msTimerWait = 0;
+static uint8_t  _waitMs     = POWER_UP_MS;
+static char     _isOn       = 0;
+static char     _wantOn     = 0;
+static char     _text[2][LINE_LENGTH];
+static uint8_t  _linesToSend = 0; //One bit per line
+
+char LcdThisIsOn()     { return _wantOn; }
+void LcdThisTurnOn()   {        _wantOn = 1; }
+void LcdThisTurnOff()  {        _wantOn = 0; }
+char LcdThisIsReady()  { return _initStep >= INIT_STEP_COUNT && !_linesToSend && _transaction.status != I2C_THIS_PENDING; }
+
+void LcdThisSendText(const char* line0, const char* line1)
+{
+    for (uint8_t i = 0; i < LINE_LENGTH; i++)
+    {
+        _text[0][i] = line0[i];
+        _text[1][i] = line1[i];
+    }
+    _linesToSend = 3;
+}
+
+static void addNibble(uint8_t nibble, uint8_t rs) //Nibble in the top four bits
+{
+    uint8_t value = (nibble & 0xF0) | rs | (_isOn ? PIN_BACKLIGHT : 0);
+    _buffer[_length++] = value | PIN_E;
+    _buffer[_length++] = value;
+}
+static void addByte(uint8_t value, uint8_t rs)
+{
+    addNibble(value     , rs);
+    addNibble(value << 4, rs);
+}
+static void send()
+{
+    _transaction.sendLength = _length;
+    I2CThisSubmit(&_transaction);
+}
+
+void LcdThisInit(uint8_t address)
+{
+    _transaction.address = address;
+    _msTimerWait = MsTimerCount;
+}
+void LcdThisMain()
+{
+    if (_transaction.status == I2C_THIS_PENDING) return;
+    if (_transaction.status == I2C_THIS_FAILED) //The buffer still holds it
+    {
+        send();
+        return;
+    }
+    if (_transaction.status == I2C_THIS_DONE)
+    {
+        _transaction.status = I2C_THIS_IDLE;
+        _msTimerWait = MsTimerCount;
+    }
+    if (!MsTimerRelative(_msTimerWait, _waitMs + 1UL)) return;
+    _waitMs = 0;
+    _length = 0;
+
+    if (_initStep < INIT_STEP_COUNT)
+    {
+        const struct initStep* pStep = &_initSteps[_initStep++];
+        if (pStep->nibbleOnly) addNibble(pStep->value, 0);
+        else                   addByte  (pStep->value, 0);
+        _waitMs = pStep->waitMs;
+        send();
+        return;
+    }
+
+    if (_isOn != _wantOn)
+    {
+        _isOn = _wantOn;
+        addByte(_isOn ? COMMAND_DISPLAY_ON : COMMAND_DISPLAY_OFF, 0);
+        send();
+        return;
+    }
+
+    for (uint8_t line = 0; line < 2; line++)
+    {
+        if (!(_linesToSend & (1 << line))) continue;
+        _linesToSend &= (uint8_t)~(1 << line);
+        addByte(COMMAND_ADDRESS | (line ? LINE_1_ADDRESS : 0), 0);
+        for (uint8_t i = 0; i < LINE_LENGTH; i++) addByte((uint8_t)_text[line][i], PIN_RS);
+        send();
+        return;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+#include <stdint.h>
+
+extern void LcdThisInit(uint8_t address);
+extern void LcdThisMain(void);
+
+extern char LcdThisIsOn(void);
+extern void LcdThisTurnOn(void);
+extern void LcdThisTurnOff(void);
+extern char LcdThisIsReady(void);
+extern void LcdThisSendText(const char* line0, const char* line1); //16 characters each
\ No newline at end of file
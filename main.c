@@ -6,7 +6,6 @@
 #include "../mstimer.h"
 #include "../can.h"
 #include "../i2c.h"
-#include "../lcd-1602.h"
 
 #include "adc.h"
 #include "display.h"
@@ -19,10 +18,17 @@
 #include "can-this.h"
 #include "eeprom-this.h"
 #include "i2c-this.h"
+#include "lcd-this.h"
 #include "rest.h"
 #include "cal-current.h"
 #include "cal-charge.h"
 #include "curve.h"
+#include "voltage.h"
+#include "ocv.h"
+#include "cal-pulse.h"
+#include "soh.h"
+#include "stats.h"
+#include "preheat.h"
 
 #define _XTAL_FREQ 8000000
 
@@ -42,21 +48,34 @@ void __interrupt() isr(void)
     {
         PulseHandleInterrupt();
     }
+    if (EepromThisHadInterrupt())
+    {
+        EepromThisHandleInterrupt();
+    }
+    if (I2CThisHadInterrupt())
+    {
+        I2CThisHandleInterrupt();
+    }
 }
 
 void main(void)
 {
     __delay_ms(3000); //This prevents multiple resets when programming.
     ResetInit();
+    EepromThisInit(); //Before anything reads a setting
     HrTimerInit();
     MsTickerInit(EEPROM_MS_TICK_COUNT_U16);
     AdcInit();
+    VoltageInit();
     I2CInit();
     CountInit();
+    CalPulseInit();
+    SohInit();
     PulseInit();
     OutputInit();
     HeaterInit();
-    LcdInit(I2C_ADDRESS_LCD);
+    PreheatInit();
+    LcdThisInit(I2C_ADDRESS_LCD);
     DisplayInit();
     CanInit();
     CanThisInit();
@@ -64,23 +83,31 @@ void main(void)
     CalCurrentInit();
     CalChargeInit();
     CurveInit();
+    OcvInit();
     
     ei();
-    PEIE = 1; //Enable peripheral interrupts - specifically Timer 1 and ADC
+    PEIE = 1; //Enable peripheral interrupts - specifically Timer 1, ADC, EEPROM write complete and MSSP
     
 	while(1)
 	{
         MsTimerMain();
+        EepromThisMain();
         PulseMain();
+        StatsMain();
+        VoltageMain();
+        OcvMain();
         CountMain();
+        I2CThisMain();
         TemperatureMain();
         OutputMain();
+        PreheatMain();
         HeaterMain();
         KeypadMain();
-        LcdMain();
+        LcdThisMain();
         DisplayMain();
         CanMain();
         CanThisMain();
+        CurveMain();
         RestMain(); //Be careful of order: must be after can messages received by CountSet but before CountMain runs
         CalCurrentMain();
         CalChargeMain();
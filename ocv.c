@@ -0,0 +1,79 @@
+#include <stdint.h>
+
+#include "../mstimer.h"
+
+#include "ocv.h"
+#include "voltage.h"
+#include "pulse.h"
+#include "eeprom-this.h"
+
+/*
+Open circuit voltage estimate
+=============================
+The terminal voltage differs from the open circuit voltage by the current times the internal resistance of the pack:
+    Ocv = V - I x R  (I positive when charging)
+The resistance is in micro ohms; a 280Ah pack of four cells plus links is a couple of milli ohms.
+mV = mA x uOhm / 1,000,000 so in 4 bit fixed decimal place mV4bfdp = mA x uOhm / 62500.
+
+The estimate is only trusted once the current has stayed within a band of its starting value for STEADY_MS and is small
+enough that any error in the resistance does not matter much. Until the resistance has been set (an unset eeprom reads as
+zero) the current must be near enough zero that the drop can be ignored.
+*/
+#define STEADY_MS             10UL * 60 * 1000
+#define STEADY_BAND_MA        100
+#define MAX_CURRENT_MA        5000
+#define MAX_CURRENT_NO_R_MA    200 //0.4mV across a couple of milli ohms
+
+static uint16_t _resistanceUohm = 0;
+static  int16_t _ocvMv          = 0;
+static char     _isConfident    = 0;
+
+uint16_t OcvGetResistanceUohm(          ) { return _resistanceUohm; }
+void     OcvSetResistanceUohm(uint16_t v) {        _resistanceUohm = v; EepromThisSaveU16(EEPROM_OCV_RESISTANCE_UOHM_U16, v); }
+int16_t  OcvGetMv            (          ) { return _ocvMv;          }
+char     OcvGetIsConfident   (          ) { return _isConfident;    }
+
+void OcvInit()
+{
+    _resistanceUohm = EepromThisReadU16(EEPROM_OCV_RESISTANCE_UOHM_U16);
+    if (_resistanceUohm == 0xFFFF) _resistanceUohm = 0; //Eeprom value is likely not initialised
+}
+void OcvMain()
+{
+    int32_t ma = PulseGetCurrentMa();
+    
+    //Restart the steady period whenever the current leaves the band around the value at the start
+    static uint32_t msTimerSteady = 0;
+    static int32_t  steadyMa      = 0;
+    int32_t absSteadyMa = steadyMa < 0 ? -steadyMa : steadyMa;
+    int32_t band        = STEADY_BAND_MA + absSteadyMa / 8;
+    int32_t difference  = ma - steadyMa;
+    if (difference > band || difference < -band)
+    {
+        steadyMa = ma;
+        msTimerSteady = MsTimerCount;
+    }
+    int32_t absMa = ma < 0 ? -ma : ma;
+    
+    int32_t mv4bfdp = VoltageGetAsMv4bfdp();
+    if (!mv4bfdp)
+    {
+        _isConfident = 0;
+        return;
+    }
+    
+    //Only work out the estimate when there is a new voltage
+    static uint16_t lastVersion = 0;
+    uint16_t version = VoltageGetVersion();
+    if (version != lastVersion)
+    {
+        lastVersion = version;
+        int32_t limitedMa = ma;
+        if (limitedMa >  32767) limitedMa =  32767; //Keeps the product within 32 bits; not confident at these currents anyway
+        if (limitedMa < -32767) limitedMa = -32767;
+        int32_t drop4bfdp = limitedMa * _resistanceUohm / 62500;
+        _ocvMv = (int16_t)((mv4bfdp - drop4bfdp) >> 4);
+    }
+    int32_t maxMa = _resistanceUohm ? MAX_CURRENT_MA : MAX_CURRENT_NO_R_MA;
+    _isConfident = absMa <= maxMa && MsTimerRelative(msTimerSteady, STEADY_MS);
+}
\ No newline at end of file
@@ -0,0 +1,8 @@
+#include <stdint.h>
+
+extern uint16_t OcvGetResistanceUohm(void); extern void OcvSetResistanceUohm(uint16_t);
+extern  int16_t OcvGetMv            (void);
+extern char     OcvGetIsConfident   (void);
+
+extern void OcvInit(void);
+extern void OcvMain(void);
\ No newline at end of file
@@ -3,7 +3,6 @@
 #include <stdint.h>
 
 #include "../mstimer.h"
-#include "../eeprom.h"
 
 #include "output.h"
 #include "count.h"
@@ -13,13 +12,12 @@
 #include "rest.h"
 #include "cal-charge.h"
 #include "curve.h"
+#include "adc.h"
 
 #define CHARGE     LATBbits.LB5
 #define SUPPLY_OFF LATCbits.LC7
 
-#define MIN_CHARGE_TEMPERATURE_8_BIT ( 5 << 8)
-#define MAX_CHARGE_MV    (3500 * 4) //100%
-#define MIN_DISCHARGE_MV (2500 * 4) //0%
+#define FAULT_CLEAR_MS (10UL * 60 * 1000) //A tripped output can be used again once the voltage has been back in range this long
 
 #define STATE_NEUTRAL   0
 #define STATE_CHARGE    1
@@ -32,6 +30,11 @@ static char    _dischargeEnabled = 0;
 static char    _targetMode       = 0;
 static uint8_t _targetSoc        = 0;
 static int8_t  _reboundMv        = 0;
+static uint16_t _thresholdsCapacityAh = 0; //Capacity the thresholds below were worked out for
+static uint32_t _targetCharge         = 0; //Units of 1/1024 As
+static uint32_t _chargeStartCharge    = 0;
+static uint32_t _dischargeStartCharge = 0;
+static volatile char _fault      = OUTPUT_FAULT_NONE; //Set by the adc interrupt; cleared by the main loop
 
 char OutputGetState()
 {
@@ -43,21 +46,55 @@ char OutputGetState()
         default:              return '?';
     }
 }
-static void setState(char v) {_state = v; EepromSaveChar(EEPROM_OUTPUT_STATE_CHAR, _state); }
+static void setState(char v)
+{
+    char changed = v != _state;
+    if (changed) _fault = OUTPUT_FAULT_NONE; //A new state starts afresh
+    _state = v;
+    EepromThisSaveChar(EEPROM_OUTPUT_STATE_CHAR, _state);
+    if (changed) EepromThisFlush();          //The state must be right after a power cut, which the change may cause
+}
+
+/*
+Hard limits
+===========
+The adc interrupt compares every raw sample with the limits and calls this within a few milliseconds of the battery
+going beyond one. It turns off the output concerned there and then and latches the fault; OutputMain keeps the output off
+until the state changes, the fault is cleared or the voltage has been back in range for FAULT_CLEAR_MS.
+*/
+void OutputHandleVoltageTrip(char fault)
+{
+    if (fault == OUTPUT_FAULT_OVER_VOLTAGE ) CHARGE     = 0;
+    if (fault == OUTPUT_FAULT_UNDER_VOLTAGE) SUPPLY_OFF = 0;
+    _fault = fault;
+}
+uint32_t OutputGetChargeStartCharge() { return _chargeStartCharge; }
+char     OutputGetFault        () { return _fault; }
+uint32_t OutputGetTripLatencyMs() { return AdcGetTripLatencyMs(); }
+void     OutputClearFault      () { _fault = OUTPUT_FAULT_NONE; }
 
 static void saveEnables()
 {
     uint8_t byte = 0;
     if (_chargeEnabled   ) byte |= 2;
     if (_dischargeEnabled) byte |= 1;
-    EepromSaveU8(EEPROM_OUTPUT_ENABLES_U8, byte);
+    EepromThisSaveU8(EEPROM_OUTPUT_ENABLES_U8, byte);
 }
 
 char    OutputGetChargeEnabled   () { return _chargeEnabled;    } void OutputSetChargeEnabled   (char    v) { _chargeEnabled    = v; saveEnables(); }
 char    OutputGetDischargeEnabled() { return _dischargeEnabled; } void OutputSetDischargeEnabled(char    v) { _dischargeEnabled = v; saveEnables(); }
-char    OutputGetTargetMode      () { return _targetMode;       } void OutputSetTargetMode      (char    v) { _targetMode       = v; EepromSaveChar(EEPROM_OUTPUT_TARGET_MODE_CHAR, _targetMode); }
-uint8_t OutputGetTargetSoc       () { return _targetSoc;        } void OutputSetTargetSoc       (uint8_t v) { _targetSoc        = v; EepromSaveU8  (EEPROM_OUTPUT_TARGET_SOC_U8   , _targetSoc ); } 
-int8_t  OutputGetReboundMv       () { return _reboundMv;        } void OutputSetReboundMv       (int8_t  v) { _reboundMv        = v; EepromSaveS8  (EEPROM_OUTPUT_REBOUND_MV_S8   , _reboundMv ); } 
+char    OutputGetTargetMode      () { return _targetMode;       } void OutputSetTargetMode      (char    v) { _targetMode       = v; EepromThisSaveChar(EEPROM_OUTPUT_TARGET_MODE_CHAR, _targetMode); }
+static void makeThresholds() //Only called when the target or the capacity changes
+{
+    _thresholdsCapacityAh = CountGetCapacityAh();
+    uint32_t onePercent   = CountGetChargePerPercent();
+    uint32_t margin       = onePercent / 10000 * 4999;                                        //0.4999%
+    _targetCharge         = _targetSoc * onePercent;                                          //50.000
+    _chargeStartCharge    = _targetCharge > margin ? _targetCharge - margin : 0;              //49.501 = 50 - 0.499%
+    _dischargeStartCharge = _targetCharge + margin;                                           //50.499 = 50 + 0.499%
+}
+uint8_t OutputGetTargetSoc       () { return _targetSoc;        } void OutputSetTargetSoc       (uint8_t v) { _targetSoc        = v; makeThresholds(); EepromThisSaveU8  (EEPROM_OUTPUT_TARGET_SOC_U8   , _targetSoc ); } 
+int8_t  OutputGetReboundMv       () { return _reboundMv;        } void OutputSetReboundMv       (int8_t  v) { _reboundMv        = v; EepromThisSaveS8  (EEPROM_OUTPUT_REBOUND_MV_S8   , _reboundMv ); } 
 
 void OutputInit()
 {
@@ -67,19 +104,22 @@ void OutputInit()
     CHARGE    = 0;
     SUPPLY_OFF = 0;
     
-    _state       = EepromReadChar(EEPROM_OUTPUT_STATE_CHAR);
+    _state       = EepromThisReadChar(EEPROM_OUTPUT_STATE_CHAR);
     if (_state != STATE_NEUTRAL && _state != STATE_CHARGE && _state != STATE_DISCHARGE) _state = STATE_NEUTRAL;
-    uint8_t byte = EepromReadU8  (EEPROM_OUTPUT_ENABLES_U8);
+    uint8_t byte = EepromThisReadU8  (EEPROM_OUTPUT_ENABLES_U8);
     _chargeEnabled    = byte & 2;
     _dischargeEnabled = byte & 1;
-    _targetMode = EepromReadChar(EEPROM_OUTPUT_TARGET_MODE_CHAR);
-    _targetSoc  = EepromReadU8  (EEPROM_OUTPUT_TARGET_SOC_U8);
-    _reboundMv  = EepromReadS8  (EEPROM_OUTPUT_REBOUND_MV_S8);
+    _targetMode = EepromThisReadChar(EEPROM_OUTPUT_TARGET_MODE_CHAR);
+    _targetSoc  = EepromThisReadU8  (EEPROM_OUTPUT_TARGET_SOC_U8);
+    _reboundMv  = EepromThisReadS8  (EEPROM_OUTPUT_REBOUND_MV_S8);
+    makeThresholds();
+    
+    VoltageSetTripLimitsMv(OUTPUT_MAX_CHARGE_MV, OUTPUT_MIN_DISCHARGE_MV);
 }
 
 void OutputMain()
 {
-    int16_t actualBatMv = VoltageGetAsMv();
+    int16_t actualBatMv = VoltageGetFastAsMv();
     if (!actualBatMv) //Wait until the battery voltage is valid
     {
         CHARGE     = 0;
@@ -87,24 +127,27 @@ void OutputMain()
         return;
     }
     
+    static uint32_t msTimerInRange = 0;
+    char inRange = actualBatMv < OUTPUT_MAX_CHARGE_MV && actualBatMv > OUTPUT_MIN_DISCHARGE_MV;
+    if (!inRange) msTimerInRange = MsTimerCount;
+    if (_fault && MsTimerRelative(msTimerInRange, FAULT_CLEAR_MS)) _fault = OUTPUT_FAULT_NONE;
+    
     if (_targetMode == OUTPUT_TARGET_MODE_SOC)
     {
-        uint32_t            socAmpSeconds = CountGetAmpSeconds();
-        uint32_t         targetAmpSeconds = (uint32_t)OutputGetTargetSoc() * 280 * 36;          //50.000
-        uint32_t    chargeStartAmpSeconds = targetAmpSeconds - (uint32_t)4999 * 28 * 36 / 1000; //49.501 = 50 - 0.499% 
-        uint32_t dischargeStartAmpSeconds = targetAmpSeconds + (uint32_t)4999 * 28 * 36 / 1000; //50.499 = 50 + 0.499%
+        if (_thresholdsCapacityAh != CountGetCapacityAh()) makeThresholds();
+        uint32_t socCharge = CountGetCharge();
 
         switch (_state)
         {
             case STATE_NEUTRAL:
-                if (socAmpSeconds >= dischargeStartAmpSeconds) setState(STATE_DISCHARGE); //Drifts up to 50.499% but in practice only here if the target is changed
-                if (socAmpSeconds <=    chargeStartAmpSeconds) setState(STATE_CHARGE   ); //Drifts down to 49.501%
+                if (socCharge >= _dischargeStartCharge) setState(STATE_DISCHARGE); //Drifts up to 50.499% but in practice only here if the target is changed
+                if (socCharge <=    _chargeStartCharge) setState(STATE_CHARGE   ); //Drifts down to 49.501%
                 break;
             case STATE_CHARGE:
-                if (socAmpSeconds >=         targetAmpSeconds) setState(STATE_NEUTRAL  ); //Charges to 50.000%
+                if (socCharge >=         _targetCharge) setState(STATE_NEUTRAL  ); //Charges to 50.000%
                 break;
             case STATE_DISCHARGE:
-                if (socAmpSeconds <=         targetAmpSeconds) setState(STATE_NEUTRAL  ); //Discharges to 50.000%
+                if (socCharge <=         _targetCharge) setState(STATE_NEUTRAL  ); //Discharges to 50.000%
                 break;
         }
     }
@@ -141,17 +184,19 @@ void OutputMain()
             SUPPLY_OFF = 0;
             break;
         case STATE_CHARGE:
-            _allowed = (TemperatureGetAs8bfdp() >= MIN_CHARGE_TEMPERATURE_8_BIT) &&
-                       (actualBatMv < MAX_CHARGE_MV) &&
+            _allowed = (TemperatureGetAs8bfdp() >= OUTPUT_MIN_CHARGE_TEMPERATURE_8BFDP) &&
+                       (actualBatMv < OUTPUT_MAX_CHARGE_MV) &&
                        _chargeEnabled;
-            CHARGE     = _allowed;
+            CHARGE     = _allowed && _fault != OUTPUT_FAULT_OVER_VOLTAGE; //Test the fault as late as possible in case the interrupt has just tripped
+            _allowed   = CHARGE;
             SUPPLY_OFF = 0;
             break;
         case STATE_DISCHARGE:
-            _allowed = (actualBatMv > MIN_DISCHARGE_MV) &&
+            _allowed = (actualBatMv > OUTPUT_MIN_DISCHARGE_MV) &&
                        _dischargeEnabled;
             CHARGE     = 0;
-            SUPPLY_OFF = _allowed;
+            SUPPLY_OFF = _allowed && _fault != OUTPUT_FAULT_UNDER_VOLTAGE;
+            _allowed   = SUPPLY_OFF;
             break;
     }
 }
\ No newline at end of file
@@ -7,8 +7,24 @@ extern int16_t OutputGetTargetMv        (void); extern void OutputSetTargetMv
 extern int8_t  OutputGetReboundMv       (void); extern void OutputSetReboundMv       (int8_t );
 extern char    OutputGetTargetMode      (void); extern void OutputSetTargetMode      (char   );
 
+extern uint32_t OutputGetChargeStartCharge(void); //Units of 1/1024 As; only used in the soc target mode
+
+extern char     OutputGetFault(void);
+extern uint32_t OutputGetTripLatencyMs(void);
+extern void     OutputClearFault(void);
+extern void     OutputHandleVoltageTrip(char fault); //Called from the adc interrupt
+
 extern void OutputInit(void);
 extern void OutputMain(void);
 
 #define OUTPUT_TARGET_MODE_VOLTAGE 0 //Home
-#define OUTPUT_TARGET_MODE_SOC     1 //Away
\ No newline at end of file
+#define OUTPUT_TARGET_MODE_SOC     1 //Away
+
+#define OUTPUT_MAX_CHARGE_MV    (3500 * 4) //100%
+#define OUTPUT_MIN_DISCHARGE_MV (2500 * 4) //0%
+
+#define OUTPUT_MIN_CHARGE_TEMPERATURE_8BFDP (5 << 8)
+
+#define OUTPUT_FAULT_NONE          0
+#define OUTPUT_FAULT_OVER_VOLTAGE  'O'
+#define OUTPUT_FAULT_UNDER_VOLTAGE 'U'
\ No newline at end of file
@@ -0,0 +1,211 @@
+#include <stdint.h>
+
+#include "../mstimer.h"
+
+#include "preheat.h"
+#include "eeprom-this.h"
+#include "output.h"
+#include "count.h"
+#include "temperature.h"
+#include "pulse.h"
+
+/*
+Thermal model
+=============
+Two numbers are learnt from the heater samples:
+    rise - degrees per hour at full power, over RISE_INTERVAL_MS spent above RISE_MIN_POWER, scaled up to full power;
+           it includes the losses at the time so it is what a warm up from cold actually achieves.
+    loss - power (out of 256) per degree needed to hold the battery above its surroundings. Whenever the temperature
+           has held within HOLD_BAND_8BFDP of the set point for HOLD_MS, the set point and average output are noted; two
+           holds at set points at least HOLD_MIN_STEP_8BFDP apart give the extra power per degree.
+Both are averaged with a weight of 1/LEARN_WEIGHT and saved.
+The heater uses the loss as a feed forward: when its set point moves it steps the integral by loss x change rather than
+waiting for the error to build it up.
+
+Pre heat
+========
+Charging is refused below OUTPUT_MIN_CHARGE_TEMPERATURE_8BFDP. The heater is given a set point PREHEAT_MARGIN_TENTHS
+above that:
+    - while a charge is wanted but refused for the temperature, and
+    - in the soc target mode, when the time for the discharge to reach the charge start threshold is less than the time
+      to warm up at the learnt rise plus LEAD_MS.
+
+Outcomes
+========
+A cold start runs from a charge being refused for the temperature until it is allowed. The minutes it took and the
+heater energy used are kept for the last one.
+The energy is counted at each heater sample, including those of an auto tune, as the power held since the one before.
+The output is held while the temperature is invalid so a gap counts at the power before it, up to MAX_ENERGY_GAP_MS.
+*/
+#define RISE_MIN_POWER        230
+#define RISE_INTERVAL_MS      (10UL * 60 * 1000)
+#define HOLD_BAND_8BFDP        64     //0.25 degree
+#define HOLD_MS               (30UL * 60 * 1000)
+#define HOLD_MIN_STEP_8BFDP   (2 << 8)
+#define LEARN_WEIGHT           16
+#define DEFAULT_RISE_8BFDP    (1 << 8)
+#define HEATER_MW           22000     //At full power
+#define MAX_ENERGY_GAP_MS     (24UL * 3600 * 1000)
+#define PREHEAT_MARGIN_TENTHS  10
+#define LEAD_MS               (30UL * 60 * 1000)
+#define DECIDE_MS             (60UL * 1000)
+
+static uint16_t _rise8bfdp     = 0;    //Degrees per hour at full power
+static uint16_t _loss8bfdp     = 0;    //Power out of 256 per degree
+static char     _isActive      = 0;
+static uint32_t _heaterMws     = 0;    //Wraps after about 1000Wh which is fine for differences
+static uint16_t _lastWaitMins  = 0;
+static uint16_t _lastWhTenths  = 0;
+
+uint16_t PreheatGetRise8bfdp    () { return _rise8bfdp;    }
+uint16_t PreheatGetLoss8bfdp    () { return _loss8bfdp;    }
+char     PreheatGetIsActive     () { return _isActive;     }
+uint16_t PreheatGetLastWaitMins () { return _lastWaitMins; }
+uint16_t PreheatGetLastWhTenths () { return _lastWhTenths; }
+int16_t  PreheatGetTargetTenths ()
+{
+    return TemperatureConvert8bfdpToTenths(OUTPUT_MIN_CHARGE_TEMPERATURE_8BFDP) + PREHEAT_MARGIN_TENTHS;
+}
+
+static uint16_t average(uint16_t average, int32_t value)
+{
+    if (value < 0) value = 0;
+    if (value > UINT16_MAX) value = UINT16_MAX;
+    if (!average) return (uint16_t)value; //First one
+    return (uint16_t)(average + (value - average) / LEARN_WEIGHT);
+}
+
+static void learnRise(int16_t pv8bfdp, uint8_t power0to255)
+{
+    static int16_t  startPv8bfdp = 0;
+    static uint32_t msStart      = 0;
+    static uint32_t powerTotal   = 0;
+    static uint16_t powerCount   = 0;
+    if (power0to255 < RISE_MIN_POWER) { powerCount = 0; return; } //Start again once hot
+    if (!powerCount)
+    {
+        startPv8bfdp = pv8bfdp;
+        msStart      = MsTimerCount;
+        powerTotal   = 0;
+    }
+    powerTotal += power0to255;
+    powerCount++;
+    if (!MsTimerRelative(msStart, RISE_INTERVAL_MS)) return;
+    
+    int32_t perHour = (int32_t)(pv8bfdp - startPv8bfdp) * 3600 / (int32_t)((MsTimerCount - msStart) / 1000);
+    uint8_t power   = (uint8_t)(powerTotal / powerCount);
+    _rise8bfdp = average(_rise8bfdp, perHour * 255 / power);
+    EepromThisSaveU16(EEPROM_PREHEAT_RISE_8BFDP_U16, _rise8bfdp);
+    powerCount = 0;
+}
+static void learnLoss(int16_t sp8bfdp, int16_t pv8bfdp, uint8_t power0to255)
+{
+    static uint32_t msHoldStart  = 0;
+    static uint32_t powerTotal   = 0;
+    static uint16_t powerCount   = 0;
+    static int16_t  holdSp8bfdp  = 0;
+    static uint8_t  holdPower    = 0;
+    static char     hadHold      = 0;
+    
+    int16_t error = sp8bfdp - pv8bfdp;
+    if (error > HOLD_BAND_8BFDP || error < -HOLD_BAND_8BFDP) { powerCount = 0; return; }
+    if (!powerCount)
+    {
+        msHoldStart = MsTimerCount;
+        powerTotal  = 0;
+    }
+    powerTotal += power0to255;
+    powerCount++;
+    if (!MsTimerRelative(msHoldStart, HOLD_MS)) return;
+    power0to255 = (uint8_t)(powerTotal / powerCount); //The average over the hold
+    powerCount  = 0;
+    
+    int16_t step = sp8bfdp - holdSp8bfdp;
+    if (hadHold && (step >= HOLD_MIN_STEP_8BFDP || step <= -HOLD_MIN_STEP_8BFDP))
+    {
+        int32_t perDegree = ((int32_t)power0to255 - holdPower) * 256 * 256 / step;
+        _loss8bfdp = average(_loss8bfdp, perDegree);
+        EepromThisSaveU16(EEPROM_PREHEAT_LOSS_8BFDP_U16, _loss8bfdp);
+    }
+    hadHold     = 1;
+    holdSp8bfdp = sp8bfdp;
+    holdPower   = power0to255;
+}
+void PreheatAddEnergy(uint8_t power0to255)
+{
+    static uint32_t msLastSample = 0;
+    static uint8_t  lastPower    = 0;    //Held until now
+    uint32_t msInterval = msLastSample ? MsTimerCount - msLastSample : 0;
+    msLastSample = MsTimerCount;
+    if (msInterval > MAX_ENERGY_GAP_MS) msInterval = MAX_ENERGY_GAP_MS;
+    
+    uint32_t mw = (uint32_t)lastPower * HEATER_MW / 255;
+    _heaterMws += mw * (msInterval / 1000) + mw * (msInterval % 1000) / 1000; //Seconds first so a long gap cannot overflow
+    lastPower = power0to255;
+}
+void PreheatAddSample(int16_t sp8bfdp, int16_t pv8bfdp, uint8_t power0to255)
+{
+    PreheatAddEnergy(power0to255);
+    learnRise(pv8bfdp, power0to255);
+    learnLoss(sp8bfdp, pv8bfdp, power0to255);
+}
+
+static char chargeIsNear()
+{
+    if (OutputGetTargetMode() != OUTPUT_TARGET_MODE_SOC) return 0;
+    int32_t ma = PulseGetCurrentMa();
+    if (ma >= 0) return 0;                                                 //Not discharging
+    
+    uint32_t charge      = CountGetCharge();
+    uint32_t startCharge = OutputGetChargeStartCharge();
+    if (charge <= startCharge) return 1;
+    uint32_t secondsToStart = (charge - startCharge) / ((uint32_t)-ma * COUNT_UNITS_PER_AS / 1000 + 1);
+    
+    int16_t  cold8bfdp       = TemperatureConvertTenthsTo8bfdp(PreheatGetTargetTenths()) - TemperatureGetAs8bfdp();
+    if (cold8bfdp <= 0) return 0;
+    uint16_t rise8bfdp       = _rise8bfdp ? _rise8bfdp : DEFAULT_RISE_8BFDP;
+    uint32_t secondsToWarmUp = (uint32_t)cold8bfdp * 3600 / rise8bfdp;
+    return secondsToStart <= secondsToWarmUp + LEAD_MS / 1000;
+}
+static void measureColdStart()
+{
+    static char     waiting     = 0;
+    static uint32_t msWaitStart = 0;
+    static uint32_t mwsAtStart  = 0;
+    
+    char state = OutputGetState();
+    if (!waiting)
+    {
+        if (state == 'c' && TemperatureGetAs8bfdp() < OUTPUT_MIN_CHARGE_TEMPERATURE_8BFDP)
+        {
+            waiting     = 1;
+            msWaitStart = MsTimerCount;
+            mwsAtStart  = _heaterMws;
+        }
+        return;
+    }
+    if (state == 'C')
+    {
+        _lastWaitMins = (uint16_t)((MsTimerCount - msWaitStart) / 60000);
+        _lastWhTenths = (uint16_t)((_heaterMws - mwsAtStart) / 360000);
+    }
+    if (state != 'c') waiting = 0; //Allowed, or no longer wanted
+}
+
+void PreheatInit()
+{
+    _rise8bfdp = EepromThisReadU16(EEPROM_PREHEAT_RISE_8BFDP_U16);
+    _loss8bfdp = EepromThisReadU16(EEPROM_PREHEAT_LOSS_8BFDP_U16);
+    if (_rise8bfdp == 0xFFFF) _rise8bfdp = 0; //Uninitialised eeprom
+    if (_loss8bfdp == 0xFFFF) _loss8bfdp = 0;
+}
+void PreheatMain()
+{
+    if (!TemperatureIsValid) { _isActive = 0; return; }
+    measureColdStart();
+    
+    static uint32_t msTimerDecide = 0;
+    if (!MsTimerRepetitive(&msTimerDecide, DECIDE_MS)) return;
+    char refused = OutputGetState() == 'c' && TemperatureGetAs8bfdp() < OUTPUT_MIN_CHARGE_TEMPERATURE_8BFDP;
+    _isActive = refused || chargeIsNear();
+}
\ No newline at end of file
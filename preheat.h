@@ -0,0 +1,14 @@
+#include <stdint.h>
+
+extern uint16_t PreheatGetRise8bfdp(void);
+extern uint16_t PreheatGetLoss8bfdp(void);
+extern char     PreheatGetIsActive(void);
+extern int16_t  PreheatGetTargetTenths(void);
+extern uint16_t PreheatGetLastWaitMins(void);
+extern uint16_t PreheatGetLastWhTenths(void);
+
+extern void     PreheatAddEnergy(uint8_t power0to255);
+extern void     PreheatAddSample(int16_t sp8bfdp, int16_t pv8bfdp, uint8_t power0to255);
+
+extern void     PreheatInit(void);
+extern void     PreheatMain(void);
\ No newline at end of file
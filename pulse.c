@@ -2,12 +2,13 @@
 #include <stdint.h>
 
 #include "../mstimer.h"
-#include "../eeprom.h"
 
 #include "eeprom-this.h"
 #include "voltage.h"
 #include "keypad.h"
+#include "pulse.h"
 #include "count.h"
+#include "cal-pulse.h"
 
 #define POL  PORTAbits.RA0
 
@@ -33,23 +34,55 @@
  Current at 1 hour is 61.444 / 3600 = 17mA
  
  */
-#define MA_SECONDS_PER_PULSE 61444UL
+#define MA_SECONDS_PER_PULSE PULSE_MA_SECONDS_PER_PULSE
+
+/*
+Events
+======
+The interrupt stamps each edge with the ms timer and puts it on a queue. The queue has a single producer (the interrupt)
+and a single consumer (the main loop) and each index is a single byte written from one side only, so neither side needs
+to disable interrupts. If the main loop falls behind and the queue fills, the pulse is still counted but its time is lost.
+
+The timer resolution is 1ms which is better than 0.25% of the shortest possible interval.
+The ms timer is used rather than a capture: the pulses arrive on INT0, which is not a capture input, and CCP2 with timer 3
+already triggers the adc. The interrupt is entered within microseconds of the edge so the stamp is good to the 1ms tick.
+
+Glitches
+========
+The shortest possible interval is at full scale: 61.444 / 150A = 409ms. Anything much shorter than that cannot be a
+real pulse so it is counted as a glitch and otherwise ignored.
+
+Current estimate
+================
+Each interval gives a current which is averaged with a time constant of FILTER_MS: short intervals at high current
+are smoothed while at low current, where an interval is much longer than the time constant, each one replaces the
+estimate. Between pulses the current cannot be more than one pulse over the time since the last one, so the estimate
+comes down as soon as the time since the last pulse exceeds the interval instead of waiting for the next pulse.
+*/
+#define QUEUE_SIZE      8        //Must be a power of 2
+#define MIN_INTERVAL_MS 300UL    //Below this a pulse is a glitch
+#define FILTER_MS       2000UL
 
 uint32_t PulseInterval     = 0;
 uint32_t PulseMsCount      = 0;
 char     PulsePolarity     = 1;
 char     PulsePolarityInst = 1;
 
+static uint32_t _filteredMa = 0;
+static uint16_t _glitches   = 0;
+static int32_t  _netCount   = 0; //Positive less negative pulses since reset; never reset so differences give the charge over any window
+
+uint16_t PulseGetGlitches() { return _glitches; }
+int32_t  PulseGetNetCount() { return _netCount;  }
+
 uint32_t PulseGetAbsoluteCurrentMa()
 {
     if (!PulseMsCount) return 0; //Current is unknown so zero is as good a value as any
-    uint32_t pulseInterval = MsTimerCount - PulseMsCount;
-    if (pulseInterval < PulseInterval) pulseInterval = PulseInterval; //Use the longest interval (lowest current);
+    uint32_t msSinceLastPulse = MsTimerCount - PulseMsCount;
+    if (msSinceLastPulse <= PulseInterval) return _filteredMa;
     
-    uint32_t ma;
-    if (pulseInterval < 20) ma = 999999; //For short intervals set current to an arbitrarily large number
-    else                    ma = MA_SECONDS_PER_PULSE * 1000 / pulseInterval;
-    return ma;
+    uint32_t maxMa = MA_SECONDS_PER_PULSE * 1000 / msSinceLastPulse;
+    return maxMa < _filteredMa ? maxMa : _filteredMa;
 }
 int32_t PulseGetCurrentMa()
 {
@@ -57,20 +90,39 @@ int32_t PulseGetCurrentMa()
     if (PulsePolarity) return  (int32_t)ma;
     else               return -(int32_t)ma;
 }
-static int8_t _uncountedInterrupts = 0;
+
+struct event
+{
+    uint32_t ms;
+    char     positive;
+};
+static volatile struct event _events[QUEUE_SIZE];
+static volatile uint8_t _eventsHead    = 0; //Only incremented by the interrupt
+static          uint8_t _eventsTail    = 0; //Only incremented by the main loop
+static volatile uint8_t _posUntimed    = 0; //Only incremented by the interrupt when the queue is full
+static volatile uint8_t _negUntimed    = 0;
+static          uint8_t _posUntimedCounted = 0; //Only incremented by the main loop
+static          uint8_t _negUntimedCounted = 0;
+
 char PulseHadInterrupt()
 {
     return INT0IF;
 }
 void PulseHandleInterrupt()
 {
-    if (POL)
+    char positive = POL;
+    uint8_t head = _eventsHead;
+    uint8_t next = (head + 1) & (QUEUE_SIZE - 1);
+    if (next != _eventsTail)
     {
-        if (_uncountedInterrupts < 127) _uncountedInterrupts++;
+        _events[head].ms       = MsTimerCount;
+        _events[head].positive = positive;
+        _eventsHead = next; //Publish after the event is written
     }
     else
     {
-        if (_uncountedInterrupts > -128) _uncountedInterrupts--;
+        if (positive) _posUntimed++;
+        else          _negUntimed++;
     }
     
     INT0IF = 0;          //Clear the interrupt bit
@@ -86,66 +138,69 @@ uint32_t PulseGetMsSinceLastPulse()
     return MsTimerCount - PulseMsCount;
 }
 
-void PulseMain()
+static void count(char positive)
 {
-    /*
-    PulsePolarityInst = POL;
-        
-    if (INT0IF)
+    PulsePolarity = positive;
+    if (positive)
+    {
+        CountAddCharge(CalPulseGetPosCharge());
+        CountIncPosPulses();
+        _netCount++;
+    }
+    else
+    {
+        CountSubCharge(CalPulseGetNegCharge());
+        CountIncNegPulses();
+        _netCount--;
+    }
+}
+static void addEvent(uint32_t ms, char positive)
+{
+    uint32_t lastPulseMs = PulseMsCount;
+    uint32_t interval = ms - lastPulseMs;
+    if (lastPulseMs && interval < MIN_INTERVAL_MS)
+    {
+        _glitches++;
+        return;
+    }
+    
+    if (lastPulseMs)
     {
-        INT0IF = 0;
-        PulsePolarity = POL;
-        uint32_t lastPulseMs = PulseMsCount;
-        PulseMsCount = MsTimerCount;
-        if (lastPulseMs) PulseInterval = PulseMsCount - lastPulseMs;
-        
-        if (PulsePolarity)
+        uint32_t ma = MA_SECONDS_PER_PULSE * 1000 / interval;
+        if (positive != PulsePolarity)
         {
-            CountAddMilliAmpSeconds(MA_SECONDS_PER_PULSE);
-            CountIncPosPulses();
+            _filteredMa = ma; //Start again after a change of direction
         }
         else
         {
-            CountSubMilliAmpSeconds(MA_SECONDS_PER_PULSE);
-            CountIncNegPulses();
+            uint32_t weight = 256 - FILTER_MS * 256 / (interval + FILTER_MS); //interval x 256 / (interval + FILTER_MS) without overflow: 0 to 256, the longer the interval the more it counts
+            _filteredMa = (uint32_t)((int32_t)_filteredMa + ((int32_t)ma - (int32_t)_filteredMa) * (int32_t)weight / 256);
         }
+        PulseInterval = interval;
     }
-     */
+    PulseMsCount = ms;
     
+    count(positive);
+}
+
+void PulseMain()
+{
     PulsePolarityInst = POL;
     
-    char hadPulse = 0;
-    di();
-        if (_uncountedInterrupts > 0)
-        {
-            hadPulse = 1;
-            PulsePolarity = 1;
-            _uncountedInterrupts--;
-        }
-        if (_uncountedInterrupts < 0)
-        {
-            hadPulse = 1;
-            PulsePolarity = 0;
-            _uncountedInterrupts++;
-        }
-    ei();
+    while (_eventsTail != _eventsHead)
+    {
+        addEvent(_events[_eventsTail].ms, _events[_eventsTail].positive);
+        _eventsTail = (_eventsTail + 1) & (QUEUE_SIZE - 1); //Release the slot after it is read
+    }
     
-        
-    if (hadPulse)
+    if (_posUntimedCounted != _posUntimed) //Each counter is a single byte written from one side only so no need to disable interrupts
     {
-        uint32_t lastPulseMs = PulseMsCount;
-        PulseMsCount = MsTimerCount;
-        if (lastPulseMs) PulseInterval = PulseMsCount - lastPulseMs;
-        
-        if (PulsePolarity)
-        {
-            CountAddMilliAmpSeconds(MA_SECONDS_PER_PULSE);
-            CountIncPosPulses();
-        }
-        else
-        {
-            CountSubMilliAmpSeconds(MA_SECONDS_PER_PULSE);
-            CountIncNegPulses();
-        }
+        _posUntimedCounted++;
+        count(1);
     }
-}
+    if (_negUntimedCounted != _negUntimed)
+    {
+        _negUntimedCounted++;
+        count(0);
+    }
+}
\ No newline at end of file
@@ -16,3 +16,7 @@ extern void     PulseHandleInterrupt(void);
 extern uint32_t PulseGetAbsoluteCurrentMa(void);
 extern int32_t  PulseGetCurrentMa(void);
 extern uint32_t PulseGetMsSinceLastPulse(void);
+extern uint16_t PulseGetGlitches(void);
+extern int32_t  PulseGetNetCount(void);
+
+#define PULSE_MA_SECONDS_PER_PULSE 61444L //Nominal; the adjustments for each polarity are in cal-pulse.c
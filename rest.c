@@ -1,7 +1,7 @@
 #include <stdint.h>
+#include <limits.h>
 
 #include "../mstimer.h"
-#include "../eeprom.h"
 
 #include "eeprom-this.h"
 #include "output.h"
@@ -11,6 +11,26 @@
 
 #define MAX_REST_TIMER_MS 10UL * 24 * 3600 * 1000
 
+/*
+Relaxation
+==========
+After a load is removed the voltage creeps towards the open circuit voltage. Rather than always waiting for the voltage
+settle time, the voltage it will have reached by then is predicted from a sample taken every RELAX_SAMPLE_MS.
+The creep slows down as it goes so it cannot move further before the settle time than the last step repeated for every
+sample left; the voltage at the settle time lies between now and that. Within that range the estimate is Aitken's delta
+squared, exact for a single exponential: with d1 = v1 - v0 and d2 = v2 - v1 the rest of the creep is d2 x d2 / (d1 - d2).
+It is only used while the steps keep their sign and shrink by at least RELAX_MAX_RATIO_8BFDP; a step within
+RELAX_NOISE_MV4BFDP counts as settled.
+The error bound is the distance from the estimate to the further end of the range. Once that is within
+RELAX_TOLERANCE_MV4BFDP (1mV a cell, the curve's resolution) the voltage is treated as stable and the estimate is used.
+Stability and the estimate are then held until the rest ends or the settle time is reached, when the measured voltage
+takes over, so the voltage never drops back to unstable part way through a rest.
+*/
+#define RELAX_SAMPLE_MS         5UL * 60 * 1000
+#define RELAX_MAX_RATIO_8BFDP   230     //0.9
+#define RELAX_NOISE_MV4BFDP       2
+#define RELAX_TOLERANCE_MV4BFDP (4 * 16)
+
 static uint32_t _msTimerRest = 0;
 static char     _isAtRest    = 0;
 uint32_t RestGetMsAtRest() { return MsTimerCount - _msTimerRest; }
@@ -22,25 +42,79 @@ static uint16_t _voltageSettleTimeMins = 0;
 static uint32_t _voltageSettleTimeMs   = 0;
 
 uint16_t RestGetCurrentSettleTimeMins()    { return _currentSettleTimeMins; }
-void     RestSetCurrentSettleTimeMins(uint16_t v) { _currentSettleTimeMins = v; _currentSettleTimeMs = v * 60UL * 1000; EepromSaveU16(EEPROM_REST_CURRENT_SETTLE_TIME_MINS_U16, v ); }
+void     RestSetCurrentSettleTimeMins(uint16_t v) { _currentSettleTimeMins = v; _currentSettleTimeMs = v * 60UL * 1000; EepromThisSaveU16(EEPROM_REST_CURRENT_SETTLE_TIME_MINS_U16, v ); }
 uint16_t RestGetVoltageSettleTimeMins()    { return _voltageSettleTimeMins; }
-void     RestSetVoltageSettleTimeMins(uint16_t v) { _voltageSettleTimeMins = v; _voltageSettleTimeMs = v * 60UL * 1000; EepromSaveU16(EEPROM_REST_VOLTAGE_SETTLE_TIME_MINS_U16, v ); }
+void     RestSetVoltageSettleTimeMins(uint16_t v) { _voltageSettleTimeMins = v; _voltageSettleTimeMs = v * 60UL * 1000; EepromThisSaveU16(EEPROM_REST_VOLTAGE_SETTLE_TIME_MINS_U16, v ); }
 
 static char _currentIsStable = 0;
 static char _voltageIsStable = 0;
 char RestGetCurrentIsStable() { return _currentIsStable; }
 char RestGetVoltageIsStable() { return _voltageIsStable; }
 
+static int32_t _relaxSamples[3];
+static uint8_t _relaxSampleCount   = 0;
+static int32_t _relaxEstimate4bfdp = 0;
+static int32_t _relaxBound4bfdp    = INT32_MAX;
+static char    _relaxIsStable      = 0;
+static uint32_t _msTimerRelax      = 0;
+int16_t RestGetOcvMv()               { return _relaxIsStable ? (int16_t)(_relaxEstimate4bfdp >> 4) : VoltageGetAsMv(); }
+int16_t RestGetRelaxBoundMv4bfdp()   { return _relaxBound4bfdp > INT16_MAX ? INT16_MAX : (int16_t)_relaxBound4bfdp; }
+char    RestGetVoltageIsPredicted()  { return _relaxIsStable; }
+
+static int32_t absolute(int32_t v) { return v < 0 ? -v : v; }
+static void relaxReset()
+{
+    _relaxSampleCount   = 0;
+    _relaxEstimate4bfdp = 0;
+    _relaxBound4bfdp    = INT32_MAX;
+    _relaxIsStable      = 0;
+    _msTimerRelax       = MsTimerCount; //Skip the first sample period while the slow voltage catches up with the step
+}
+static void relaxAdd(int32_t mv4bfdp, int32_t samplesLeft)
+{
+    if (_relaxIsStable) return; //Latched for the rest of the rest
+    
+    _relaxSamples[0] = _relaxSamples[1];
+    _relaxSamples[1] = _relaxSamples[2];
+    _relaxSamples[2] = mv4bfdp;
+    if (_relaxSampleCount < 3) _relaxSampleCount++;
+    if (_relaxSampleCount < 3) return;
+    
+    int32_t d1 = _relaxSamples[1] - _relaxSamples[0];
+    int32_t d2 = _relaxSamples[2] - _relaxSamples[1];
+    int32_t estimate = mv4bfdp;
+    if (absolute(d2) > RELAX_NOISE_MV4BFDP)
+    {
+        char decaying = (d1 > 0) == (d2 > 0) && absolute(d2) * 256 <= absolute(d1) * RELAX_MAX_RATIO_8BFDP;
+        if (!decaying)
+        {
+            _relaxBound4bfdp = INT32_MAX;
+            _relaxIsStable   = 0;
+            return;
+        }
+        estimate += d2 * d2 / (d1 - d2); //Steps are a few hundred so the product fits
+    }
+    int32_t low  = mv4bfdp;
+    int32_t high = mv4bfdp + d2 * samplesLeft;
+    if (low > high) { int32_t t = low; low = high; high = t; }
+    if (estimate < low ) estimate = low;
+    if (estimate > high) estimate = high;
+    
+    _relaxEstimate4bfdp = estimate;
+    _relaxBound4bfdp    = high - estimate > estimate - low ? high - estimate : estimate - low;
+    _relaxIsStable      = _relaxBound4bfdp <= RELAX_TOLERANCE_MV4BFDP;
+}
+
 void RestInit()
 {
-    uint16_t restTimeMinutes = EepromReadU16(EEPROM_REST_TIMER_MINUTES_U16);
+    uint16_t restTimeMinutes = EepromThisReadU16(EEPROM_REST_TIMER_MINUTES_U16);
     uint32_t restTimeMs = (uint32_t)restTimeMinutes << 16;
     if (restTimeMs > MAX_REST_TIMER_MS) restTimeMs = 0; //Eeprom value is likely not initialised
     _msTimerRest = MsTimerCount - restTimeMs;
 
-    _currentSettleTimeMins = EepromReadU16(EEPROM_REST_CURRENT_SETTLE_TIME_MINS_U16) ;
+    _currentSettleTimeMins = EepromThisReadU16(EEPROM_REST_CURRENT_SETTLE_TIME_MINS_U16) ;
     _currentSettleTimeMs = _currentSettleTimeMins * 60UL * 1000;
-    _voltageSettleTimeMins = EepromReadU16(EEPROM_REST_VOLTAGE_SETTLE_TIME_MINS_U16) ;
+    _voltageSettleTimeMins = EepromThisReadU16(EEPROM_REST_VOLTAGE_SETTLE_TIME_MINS_U16) ;
     _voltageSettleTimeMs = _voltageSettleTimeMins * 60UL * 1000;
 }
 
@@ -51,16 +125,28 @@ void RestMain()
     {
         if (MsTimerCount > _msTimerRest + MAX_REST_TIMER_MS) _msTimerRest = MsTimerCount - MAX_REST_TIMER_MS; //Limit the rest timer to 10 days
         uint16_t restTime16bit = (uint16_t)((MsTimerCount - _msTimerRest) >> 16);                             //Approximate minutes using ms * 65536
-        if ((restTime16bit & 0xF) == 0) EepromSaveU16(EEPROM_REST_TIMER_MINUTES_U16, restTime16bit);   //Save time about every 16 minutes
+        if ((restTime16bit & 0xF) == 0) EepromThisSaveU16(EEPROM_REST_TIMER_MINUTES_U16, restTime16bit);   //Save time about every 16 minutes
         _currentIsStable = MsTimerRelative(_msTimerRest, _currentSettleTimeMs);
-        _voltageIsStable = MsTimerRelative(_msTimerRest, _voltageSettleTimeMs);
+        
+        int32_t mv4bfdp = VoltageGetAsMv4bfdp();
+        if (mv4bfdp && MsTimerRepetitive(&_msTimerRelax, RELAX_SAMPLE_MS))
+        {
+            uint32_t msAtRest = MsTimerCount - _msTimerRest;
+            uint32_t msLeft   = msAtRest < _voltageSettleTimeMs ? _voltageSettleTimeMs - msAtRest : 0;
+            relaxAdd(mv4bfdp, (int32_t)(msLeft / RELAX_SAMPLE_MS));
+        }
+        
+        char waited = MsTimerRelative(_msTimerRest, _voltageSettleTimeMs);
+        if (waited) _relaxIsStable = 0; //The measured voltage is now the better one
+        _voltageIsStable = waited || _relaxIsStable;
     }
     else
     {
         _msTimerRest = MsTimerCount;                                                                           //Set rest time to zero
-        EepromSaveU16(EEPROM_REST_TIMER_MINUTES_U16, 0);                                                //Save time - eeprom save checks the current value (no wear) and only actually saves if different
+        EepromThisSaveU16(EEPROM_REST_TIMER_MINUTES_U16, 0);                                                //Save time - eeprom save checks the current value (no wear) and only actually saves if different
         _currentIsStable = 0;
-        _voltageIsStable = 0;                                                                                                
+        _voltageIsStable = 0;
+        relaxReset();                                                                                                
     }
     
     
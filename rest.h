@@ -10,3 +10,6 @@ extern uint16_t RestGetVoltageSettleTimeMins(void);
 extern void     RestSetVoltageSettleTimeMins(uint16_t);
 extern char     RestGetCurrentIsStable(void);
 extern char     RestGetVoltageIsStable(void);
+extern char     RestGetVoltageIsPredicted(void);
+extern int16_t  RestGetOcvMv(void);                //The extrapolated voltage while it is predicted, otherwise the measured
+extern int16_t  RestGetRelaxBoundMv4bfdp(void);
@@ -0,0 +1,85 @@
+#include <stdint.h>
+
+#include "eeprom-this.h"
+#include "soh.h"
+#include "count.h"
+
+/*
+State of health
+===============
+A calibration converts the rest voltage to a state of charge and then to As using the capacity in use. Between two
+calibrations the coulomb count measures the real charge which moved so:
+    real capacity = capacity in use x counted change / calculated change
+The calculated change must be large or the voltage error swamps it, so only calibrations at least MIN_SPAN_PERCENT apart
+are used, and not if the count hit empty or full in between as it then stopped following the battery.
+The count is set to the calculated value on every pass of a rest, not just the first, so the baseline for the next span is
+the last value it was set to: SohSetBaselineAs is called each time.
+The baseline is dropped when the count is set any other way, by SohClearBaseline, or the capacity in use has changed since.
+Each estimate outside 50% to 120% of the capacity in use is rejected; the others are averaged with a weight of 1/8.
+If apply is set then, after MIN_ESTIMATES, the capacity in count.c follows the average to the nearest Ah.
+*/
+#define MIN_SPAN_PERCENT 20
+#define LOG2_WEIGHT       3
+#define MIN_ESTIMATES     3
+
+static uint16_t _capacityDeciAh     = 0;
+static char     _apply              = 0;
+static uint8_t  _estimates          = 0; //Since reset
+static uint16_t _lastEstimateDeciAh = 0;
+static uint32_t _baselineAs         = 0; //The value the count was last set to
+static uint16_t _baselineCapacityAh = 0; //The capacity in use when the baseline was set
+static char     _baselineIsValid    = 0;
+
+uint16_t SohGetCapacityDeciAh    () { return _capacityDeciAh;     } void SohSetCapacityDeciAh(uint16_t v) { _capacityDeciAh = v; EepromThisSaveU16 (EEPROM_SOH_CAPACITY_DECI_AH_U16, v); }
+char     SohGetApply             () { return _apply;              } void SohSetApply         (char     v) { _apply          = v; EepromThisSaveChar(EEPROM_SOH_APPLY_CHAR          , v); }
+uint8_t  SohGetEstimates         () { return _estimates;          }
+uint16_t SohGetLastEstimateDeciAh() { return _lastEstimateDeciAh; }
+
+static void apply()
+{
+    if (!_apply || _estimates < MIN_ESTIMATES) return;
+    uint16_t ah = (_capacityDeciAh + 5) / 10;
+    if (ah != CountGetCapacityAh()) CountSetCapacityAh(ah);
+}
+void SohSetBaselineAs(uint32_t calculatedAs)
+{
+    _baselineAs         = calculatedAs;
+    _baselineCapacityAh = CountGetCapacityAh();
+    _baselineIsValid    = 1;
+}
+void SohClearBaseline()
+{
+    _baselineIsValid = 0;
+}
+void SohAddCalibration(uint32_t calculatedAs, uint32_t countedAs)
+{
+    if (!_baselineIsValid || CountGetHasSaturated()) return;
+    if (CountGetCapacityAh() != _baselineCapacityAh) { _baselineIsValid = 0; return; } //The baseline was worked out with another capacity
+    
+    uint16_t capacityAh     = CountGetCapacityAh();
+    int32_t  calculatedSpan = (int32_t)(calculatedAs - _baselineAs);
+    int32_t  countedSpan    = (int32_t)(countedAs    - _baselineAs); //The count was set to the baseline
+    if (calculatedSpan < 0) { calculatedSpan = -calculatedSpan; countedSpan = -countedSpan; }
+    if (calculatedSpan < MIN_SPAN_PERCENT * 36L * capacityAh) return;
+    if (countedSpan <= 0) return;
+    
+    while (countedSpan >= 0x40000L) { countedSpan >>= 1; calculatedSpan >>= 1; } //Keeps the 14 bit deci Ah x span within 32 bits
+    uint32_t estimateDeciAh = (capacityAh * 10UL * (uint32_t)countedSpan + (uint32_t)calculatedSpan / 2) / (uint32_t)calculatedSpan;
+    if (estimateDeciAh < capacityAh *  5UL) return; // 50%
+    if (estimateDeciAh > capacityAh * 12UL) return; //120%
+    _lastEstimateDeciAh = (uint16_t)estimateDeciAh;
+    
+    int32_t average = _capacityDeciAh;
+    average += ((int32_t)estimateDeciAh - average) >> LOG2_WEIGHT;
+    SohSetCapacityDeciAh((uint16_t)average);
+    if (_estimates < 255) _estimates++;
+    
+    apply();
+}
+void SohInit()
+{
+    _capacityDeciAh = EepromThisReadU16 (EEPROM_SOH_CAPACITY_DECI_AH_U16);
+    _apply          = EepromThisReadChar(EEPROM_SOH_APPLY_CHAR);
+    if (_apply != 1) _apply = 0; //Uninitialised eeprom
+    if (_capacityDeciAh < COUNT_MIN_CAPACITY_AH * 10U || _capacityDeciAh > COUNT_MAX_CAPACITY_AH * 10U) _capacityDeciAh = CountGetCapacityAh() * 10; //Uninitialised eeprom
+}
\ No newline at end of file
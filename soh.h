@@ -0,0 +1,12 @@
+#include <stdint.h>
+
+extern uint16_t SohGetCapacityDeciAh(void); extern void SohSetCapacityDeciAh(uint16_t);
+extern char     SohGetApply         (void); extern void SohSetApply         (char);
+extern uint8_t  SohGetEstimates     (void);
+extern uint16_t SohGetLastEstimateDeciAh(void);
+
+extern void     SohAddCalibration(uint32_t calculatedAs, uint32_t countedAs);
+extern void     SohSetBaselineAs (uint32_t calculatedAs); //Call whenever the count is set to a calculated value
+extern void     SohClearBaseline (void);                  //Call whenever the count is set to anything else
+
+extern void     SohInit(void);
\ No newline at end of file
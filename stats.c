@@ -0,0 +1,127 @@
+#include <stdint.h>
+
+#include "../mstimer.h"
+
+#include "stats.h"
+#include "voltage.h"
+#include "temperature.h"
+#include "pulse.h"
+
+/*
+History
+=======
+Each quantity is sampled once a second into an accumulator holding the min, max, total and count so each sample
+costs a few compares and an add. Every 60 samples the accumulator is closed into a minute bucket and folded into
+the hour accumulator; every 60 minutes the hour accumulator is closed into an hour bucket.
+The buckets are kept in fixed rings: 3 quantities x (8 minutes + 12 hours) x 8 bytes = 480 bytes.
+*/
+#define SAMPLE_MS           1000
+#define SAMPLES_PER_MINUTE    60
+#define MINUTES_PER_HOUR      60
+
+struct accumulator
+{
+    int16_t  min;
+    int16_t  max;
+    int32_t  total;
+    uint16_t count;
+};
+
+static struct accumulator _minuteAccumulators[STATS_QUANTITY_COUNT];
+static struct accumulator _hourAccumulators  [STATS_QUANTITY_COUNT];
+
+static struct StatsBucket _minutes[STATS_MINUTE_COUNT][STATS_QUANTITY_COUNT];
+static struct StatsBucket _hours  [STATS_HOUR_COUNT  ][STATS_QUANTITY_COUNT];
+static uint8_t _minutesNext  = 0; //Slot to be written next
+static uint8_t _minutesCount = 0; //Slots written so far up to STATS_MINUTE_COUNT
+static uint8_t _hoursNext    = 0;
+static uint8_t _hoursCount   = 0;
+
+static char get(struct StatsBucket* pRing, uint8_t size, uint8_t next, uint8_t count, uint8_t quantity, uint8_t age, struct StatsBucket* pBucket)
+{
+    if (quantity >= STATS_QUANTITY_COUNT || age >= count) return 0;
+    uint8_t slot = next + size - 1 - age;
+    if (slot >= size) slot -= size;
+    *pBucket = pRing[slot * STATS_QUANTITY_COUNT + quantity];
+    return 1;
+}
+char StatsGetMinute(uint8_t quantity, uint8_t age, struct StatsBucket* pBucket)
+{
+    return get(&_minutes[0][0], STATS_MINUTE_COUNT, _minutesNext, _minutesCount, quantity, age, pBucket);
+}
+char StatsGetHour(uint8_t quantity, uint8_t age, struct StatsBucket* pBucket)
+{
+    return get(&_hours[0][0], STATS_HOUR_COUNT, _hoursNext, _hoursCount, quantity, age, pBucket);
+}
+
+static void addToAccumulator(struct accumulator* pAccumulator, int16_t min, int16_t max, int32_t total, uint16_t count)
+{
+    if (!count) return;
+    if (!pAccumulator->count || min < pAccumulator->min) pAccumulator->min = min;
+    if (!pAccumulator->count || max > pAccumulator->max) pAccumulator->max = max;
+    pAccumulator->total += total;
+    pAccumulator->count += count;
+}
+static void closeAccumulator(struct accumulator* pAccumulator, struct StatsBucket* pBucket)
+{
+    pBucket->min   = pAccumulator->min;
+    pBucket->max   = pAccumulator->max;
+    pBucket->mean  = pAccumulator->count ? (int16_t)(pAccumulator->total / pAccumulator->count) : 0;
+    pBucket->count = pAccumulator->count;
+    pAccumulator->total = 0;
+    pAccumulator->count = 0;
+}
+static int16_t getCurrent10Ma()
+{
+    int32_t ma = PulseGetCurrentMa() / 10;
+    if (ma >  INT16_MAX) ma =  INT16_MAX;
+    if (ma < -INT16_MAX) ma = -INT16_MAX;
+    return (int16_t)ma;
+}
+static void closeMinute()
+{
+    for (uint8_t q = 0; q < STATS_QUANTITY_COUNT; q++)
+    {
+        struct accumulator* pMinute = &_minuteAccumulators[q];
+        addToAccumulator(&_hourAccumulators[q], pMinute->min, pMinute->max, pMinute->total, pMinute->count);
+        closeAccumulator(pMinute, &_minutes[_minutesNext][q]);
+    }
+    _minutesNext++;
+    if (_minutesNext >= STATS_MINUTE_COUNT) _minutesNext = 0;
+    if (_minutesCount < STATS_MINUTE_COUNT) _minutesCount++;
+}
+static void closeHour()
+{
+    for (uint8_t q = 0; q < STATS_QUANTITY_COUNT; q++) closeAccumulator(&_hourAccumulators[q], &_hours[_hoursNext][q]);
+    _hoursNext++;
+    if (_hoursNext >= STATS_HOUR_COUNT) _hoursNext = 0;
+    if (_hoursCount < STATS_HOUR_COUNT) _hoursCount++;
+}
+void StatsMain()
+{
+    static uint32_t msTimerSample = 0;
+    static uint8_t  samples       = 0;
+    static uint8_t  minutes       = 0;
+    
+    if (!MsTimerRepetitive(&msTimerSample, SAMPLE_MS)) return;
+    
+    int16_t values[STATS_QUANTITY_COUNT];
+    values[STATS_CURRENT    ] = getCurrent10Ma();
+    values[STATS_VOLTAGE    ] = VoltageGetFastAsMv();
+    values[STATS_TEMPERATURE] = TemperatureGetAsTenths();
+    for (uint8_t q = 0; q < STATS_QUANTITY_COUNT; q++)
+    {
+        if (q == STATS_TEMPERATURE && !TemperatureIsValid) continue;
+        addToAccumulator(&_minuteAccumulators[q], values[q], values[q], values[q], 1);
+    }
+    
+    samples++;
+    if (samples < SAMPLES_PER_MINUTE) return;
+    samples = 0;
+    closeMinute();
+    
+    minutes++;
+    if (minutes < MINUTES_PER_HOUR) return;
+    minutes = 0;
+    closeHour();
+}
\ No newline at end of file
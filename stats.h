@@ -0,0 +1,22 @@
+#include <stdint.h>
+
+struct StatsBucket
+{
+    int16_t  min;
+    int16_t  max;
+    int16_t  mean;
+    uint16_t count; //Samples folded into the bucket
+};
+
+#define STATS_CURRENT     0 //10mA
+#define STATS_VOLTAGE     1 //mV
+#define STATS_TEMPERATURE 2 //tenths of a degree
+#define STATS_QUANTITY_COUNT 3
+
+#define STATS_MINUTE_COUNT  8 //Minute buckets kept
+#define STATS_HOUR_COUNT   12 //Hour buckets kept
+
+extern char StatsGetMinute(uint8_t quantity, uint8_t age, struct StatsBucket* pBucket); //Age 0 is the latest complete bucket; returns 0 if there is none
+extern char StatsGetHour  (uint8_t quantity, uint8_t age, struct StatsBucket* pBucket);
+
+extern void StatsMain(void);
\ No newline at end of file
@@ -2,7 +2,6 @@
 #include <stdbool.h>
 
 #include "../mstimer.h"
-#include "../i2c.h"
 
 #include "i2c-this.h"
 
@@ -33,51 +32,71 @@ int16_t TemperatureGetAsTenths()
     return TemperatureConvert8bfdpToTenths(_temperature8bfdp);
 }
 /*
-Oversampling; extra bits resolution; speed @ 250ms sampling
-0 = 1x      ; 0                    ; 250ms
-1 = 2x;     ; 0.5                  ; 500ms
-2 = 4x;     ; 1                    ; 1s
-3 = 8x;     ; 1.5                  ; 2s
-4 = 16x;    ; 2                    ; 4s
-5 = 32x;    ; 2.5                  ; 8s
-6 = 64x;    ; 3                    ; 16s
-7 = 128x;   ; 3.5                  ; 32s
-8 = 256x;   ; 4                    ; 64s
- 
  LM75A          uses 11 bits to represent +/- 127 deg min 300ms or 3 significant binary places
  ADT7410 should use  16 bits to represent +/- 255 deg min 240ms or 7 significant binary places
  ADT7410 only   uses 13 bits to represent +/- 255 deg min 240ms or 4 significant binary places
  Observed that ADT7410 varied by 4 or bit 2 over several seconds,which equates to only 5 significant binary places. Solution was to add 4 more places by sampling over a minute.
  LM75A   is naturally 8bfdp ie 0bNNNN NNNN FFF0 0000
  ADT7410 is naturally 7bfdp ie 0bNNNN NNNN NFFF FFFF so has to be shifted left by 1 bit to make it 8bfdp
+
+Filter
+======
+Rather than average 256 samples and update once a minute, each sample updates the value:
+    a boxcar of the last BOXCAR_SIZE samples, a running total of 7bfdp x 16 = 11bfdp, then
+    an exponential average with a weight of 1 / 2^EMA_SHIFT, a time constant of 128 x 250ms = 32s.
+Against the old minute average in the host simulation in test/temperature.c, they are a little less noisy and reach 90%
+of a step a little sooner on average, and the heater gets a new value every 250ms. A shorter average settles faster
+but is noisier than the old one.
+The noise is the exponential average, weight 1 / 2^NOISE_SHIFT, of how far each sample is from the boxcar mean.
+It uses 2 x BOXCAR_SIZE + 13 bytes of ram.
 */
 #define SAMPLE_INTERVAL_MS 250
-#define BIT_SHIFT_LEFT_TO_MAKE_8BFDP 1
-#define OVERSAMPLE_RATE 8
-#define   DECIMATE_RATE (OVERSAMPLE_RATE - BIT_SHIFT_LEFT_TO_MAKE_8BFDP)
+#define BOXCAR_SIZE        16     //Must be 16 so the boxcar total is 11bfdp
+#define EMA_SHIFT           7
+#define NOISE_SHIFT         6
+#define BIT_SHIFT_RIGHT_11BFDP_TO_8BFDP 3
+
+static int16_t _boxcar[BOXCAR_SIZE];
+static uint8_t _boxcarIndex = 0;
+static int32_t _boxcarTotal = 0;   //11bfdp
+static int32_t _ema         = 0;   //11bfdp x 2^EMA_SHIFT
+static int32_t _noise       = 0;   //11bfdp x 2^NOISE_SHIFT
+
+int16_t TemperatureGetNoise8bfdp()
+{
+    return (int16_t)((_noise >> NOISE_SHIFT) >> BIT_SHIFT_RIGHT_11BFDP_TO_8BFDP);
+}
 static void addSample(int16_t value)
 {
-    //On startup use the first sample
+    //On startup fill the filter with the first sample
     if (!TemperatureIsValid)
     {
-        _temperature8bfdp = value << BIT_SHIFT_LEFT_TO_MAKE_8BFDP;
+        for (uint8_t i = 0; i < BOXCAR_SIZE; i++) _boxcar[i] = value;
+        _boxcarTotal = (int32_t)value * BOXCAR_SIZE;
+        _ema         = _boxcarTotal << EMA_SHIFT;
+        _noise       = 0;
+        _temperature8bfdp = (int16_t)(_boxcarTotal >> BIT_SHIFT_RIGHT_11BFDP_TO_8BFDP);
         TemperatureSampleIsReadyForUseByHeater = 1;
         TemperatureIsValid = 1;
         return;
     }
     
-    //After startup oversample and decimate
-    static int32_t total = 0;
-    static uint16_t count = 0;
-    total += value;
-    count++;
-    if (count >= (1 << OVERSAMPLE_RATE))
-    {
-        _temperature8bfdp = (int16_t)(total >> DECIMATE_RATE);
-        total = 0;
-        count = 0;
-        TemperatureSampleIsReadyForUseByHeater = 1;
-    }
+    //Boxcar
+    _boxcarTotal += value - _boxcar[_boxcarIndex];
+    _boxcar[_boxcarIndex] = value;
+    _boxcarIndex++;
+    if (_boxcarIndex >= BOXCAR_SIZE) _boxcarIndex = 0;
+    
+    //Exponential average
+    _ema += _boxcarTotal - (_ema >> EMA_SHIFT);
+    _temperature8bfdp = (int16_t)((_ema >> EMA_SHIFT) >> BIT_SHIFT_RIGHT_11BFDP_TO_8BFDP);
+    
+    //Noise
+    int32_t deviation = (int32_t)value * BOXCAR_SIZE - _boxcarTotal;
+    if (deviation < 0) deviation = -deviation;
+    _noise += deviation - (_noise >> NOISE_SHIFT);
+    
+    TemperatureSampleIsReadyForUseByHeater = 1;
 }
 static void oldaddSample(int16_t value)
 {
@@ -107,72 +126,41 @@ static void oldaddSample(int16_t value)
     if (value < _temperature8bfdp) _temperature8bfdp--;
 }
 
+/*
+Reading the ADT7410
+===================
+Each SAMPLE_INTERVAL_MS the temperature register is read: pointer 0 is sent and two bytes read after a repeated start.
+When that completes the next one shot conversion is started. Both go through the interrupt driven queue in i2c-this.c
+so the main loop only submits and checks.
+*/
+static const uint8_t _readSend[]   = { 0 };          //Set pointer to temperature register
+static const uint8_t _configSend[] = { 3, 0xA0 };    //Set pointer to configuration register; bit 7 = 1 (16bit); bit (6:5) = 01 = one shot. Conversion time is typically 240 ms.
+static uint8_t _readReceive[2];                      //Holds a signed 16 bit number
+static struct I2CThisTransaction _read   = { I2C_ADDRESS_ADT7410, I2C_THIS_PRIORITY_TEMPERATURE, sizeof(_readSend)  , sizeof(_readReceive), _readSend  , _readReceive, I2C_THIS_IDLE };
+static struct I2CThisTransaction _config = { I2C_ADDRESS_ADT7410, I2C_THIS_PRIORITY_TEMPERATURE, sizeof(_configSend), 0                   , _configSend, 0           , I2C_THIS_IDLE };
+
 void TemperatureMain()
 {
-    static uint32_t msTimerRepetitive = 0;
-    if (MsTimerRepetitive(&msTimerRepetitive, SAMPLE_INTERVAL_MS))
+    if (_read.status == I2C_THIS_DONE)
     {
-        uint8_t bytes[2]; //Holds a signed 16 bit number
-        int     result = 0;
-
-        //Assume at this point that the conversion has completed and that bit (6:5) = 11 = shutdown
-        //Set pointer to temperature register
-        bytes[0] = 0; //Set pointer to temperature register
-        I2CSend(I2C_ADDRESS_ADT7410, 1, bytes, &result);
-        if (result) return;
-        
-        //Read the temperature
-        bytes[0] = 0x80; //-128 degrees which does not exist so cannot be returned
-        I2CReceive(I2C_ADDRESS_ADT7410, 2, bytes, &result);
-        if (bytes[0] == 0x80) return;
-        if (result) return;
-        uint16_t msb = bytes[0];
-        uint16_t lsb = bytes[1];
-        uint16_t data16bit = (msb << 8) + lsb;
-        addSample((int16_t)data16bit);
-        
-        //Start the next conversion by setting to one shot mode and 16 bit
-        bytes[0] = 3; //Set pointer to configuration register
-        bytes[1] = 0xA0; //bit 7 = 1 (16bit); bit (6:5) = 01 = one shot. Conversion time is typically 240 ms.
-        I2CSend(I2C_ADDRESS_ADT7410, 2, bytes, &result);
-        if (result) return;
+        _read.status = I2C_THIS_IDLE;
+        if (_readReceive[0] != 0x80) //-128 degrees which does not exist so cannot be returned
+        {
+            uint16_t msb = _readReceive[0];
+            uint16_t lsb = _readReceive[1];
+            uint16_t data16bit = (msb << 8) + lsb;
+            addSample((int16_t)data16bit);
+        }
+        I2CThisSubmit(&_config); //Start the next conversion
     }
-}
-
-void oldTemperatureMain()
-{
+    if (_read.status == I2C_THIS_FAILED) _read.status = I2C_THIS_IDLE;
+    
     static uint32_t msTimerRepetitive = 0;
-    if (MsTimerRepetitive(&msTimerRepetitive, 500UL))
+    if (MsTimerRepetitive(&msTimerRepetitive, SAMPLE_INTERVAL_MS))
     {
-        uint8_t bytes[2]; //Holds a signed 16 bit number
-        int     result = 0;
-
-        //Prevent temp register being changed mid read by putting device in shutdown mode
-        bytes[0] = 1; //Set pointer to configuration register
-        bytes[1] = 1; //Shutdown mode
-        I2CSend(I2C_ADDRESS_LM75A, 2, bytes, &result);
-        if (result) return;
-        
-        //Read the temperature
-        bytes[0] = 0; //Set pointer to temperature register
-        I2CSend(I2C_ADDRESS_LM75A, 1, bytes, &result);
-        if (result) return;
-        
-        bytes[0] = 0x80; //-128 degrees which does not exist so cannot be returned
-        bytes[1] = 0x01; //The unused small fraction are not used and are returned as zero
-        I2CReceive(I2C_ADDRESS_LM75A, 2, bytes, &result);
-        if (bytes[0] == 0x80) return;
-        if (bytes[1] == 0x01) return;
-        if (result) return;
-        uint16_t msb = bytes[0];
-        uint16_t lsb = bytes[1];
-        uint16_t data16bit = (msb << 8) + (lsb & 0xE0);
-        addSample((int16_t)data16bit);
-        
-        //Start temp updates by putting back to normal mode
-        bytes[0] = 1; //Set pointer to configuration register
-        bytes[1] = 0; //Normal mode
-        I2CSend(I2C_ADDRESS_LM75A, 2, bytes, &result);
-        if (result) return;
+        if (_read.status == I2C_THIS_PENDING || _config.status == I2C_THIS_PENDING) return; //Still busy with the last one
+        //Assume at this point that the conversion has completed and that bit (6:5) = 11 = shutdown
+        _readReceive[0] = 0x80;
+        I2CThisSubmit(&_read);
     }
 }
\ No newline at end of file
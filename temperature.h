@@ -6,5 +6,6 @@ extern char    TemperatureIsValid;
 extern char    TemperatureSampleIsReadyForUseByHeater;
 extern int16_t TemperatureGetAs8bfdp(void);
 extern int16_t TemperatureGetAsTenths(void);
+extern int16_t TemperatureGetNoise8bfdp(void);
 
 extern    void TemperatureMain(void);
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../mstimer.h"
+
+#include "../eeprom-this.h"
+#include "../cal-current.h"
+#include "../count.h"
+#include "../pulse.h"
+
+/*
+Zero current offset
+===================
+Simulates a continuous rest in which the pulse counter sees a small current, starting from a random phase of the first
+pulse, and runs cal-current.c with count.c each second for 24 hours. Reports when the offset first stays within 1mA of
+cancelling the current, where it ends, and how many times the offset was saved to the eeprom.
+The pulses are 61444mAs each so 1mA is one pulse in 17 hours: the last mA takes a long time.
+First it checks that count.c adds an offset over an hour to within a unit of offset x time.
+*/
+#define HOURS   24
+#define RUNS    20 //Random phases for each current
+
+extern uint8_t HostEeprom[1024];
+
+static int32_t _netCount = 0;
+int32_t PulseGetNetCount()       { return _netCount; }
+char    RestGetCurrentIsStable() { return 1; }
+
+struct result
+{
+    uint32_t msSettled; //When the offset last came within 1mA
+    int16_t  offsetMa;
+    uint16_t saves;
+};
+static struct result run(int32_t seenMa)
+{
+    memset(HostEeprom, 0, sizeof(HostEeprom));
+    CountInit();
+    CountSetCurrentOffsetMa(0);
+    CalCurrentInit();
+    MsTimerCount = 1;
+    _netCount = 0;
+    
+    int32_t  phaseMas = rand() % PULSE_MA_SECONDS_PER_PULSE; //Charge already towards the first pulse in the direction of the current
+    if (seenMa < 0) phaseMas = -phaseMas;
+    int16_t  savedMa  = EepromThisReadS16(EEPROM_CURRENT_OFFSET_MA_S16);
+    struct result result = { 0, 0, 0 };
+    char     settled  = 0;
+    for (uint32_t s = 0; s < HOURS * 3600UL; s++)
+    {
+        MsTimerCount += 1000;
+        phaseMas += seenMa;
+        while (phaseMas >= PULSE_MA_SECONDS_PER_PULSE) { phaseMas -= PULSE_MA_SECONDS_PER_PULSE; _netCount++; }
+        while (phaseMas <= -PULSE_MA_SECONDS_PER_PULSE) { phaseMas += PULSE_MA_SECONDS_PER_PULSE; _netCount--; }
+        CalCurrentMain();
+        
+        int16_t error = CountGetCurrentOffsetMa() + (int16_t)seenMa;
+        char within = error >= -1 && error <= 1;
+        if (within && !settled) result.msSettled = MsTimerCount;
+        settled = within;
+        int16_t saved = EepromThisReadS16(EEPROM_CURRENT_OFFSET_MA_S16);
+        if (saved != savedMa) { savedMa = saved; result.saves++; }
+    }
+    if (!settled) result.msSettled = 0;
+    result.offsetMa = CountGetCurrentOffsetMa();
+    return result;
+}
+
+static char offsetIsExact(int16_t ma) //Counts an offset for an hour and compares the charge with offset x time
+{
+    memset(HostEeprom, 0, sizeof(HostEeprom));
+    CountInit();
+    CountSetCurrentOffsetMa(ma);
+    CountSetSocPercent(50);
+    uint32_t start = CountGetCharge();
+    for (uint32_t s = 0; s < 3600; s++)
+    {
+        MsTimerCount += 1000;
+        CountMain();
+    }
+    int32_t counted  = (int32_t)(CountGetCharge() - start);
+    int32_t expected = (int32_t)((int64_t)ma * 3600 * COUNT_UNITS_PER_AS / 1000);
+    printf("Offset %4dmA for an hour counts %8d units against %8d\n", ma, counted, expected);
+    return counted - expected >= -1 && counted - expected <= 1;
+}
+
+int main()
+{
+    srand(1);
+    int failed = 0;
+    static const int16_t offsets[] = { 1, -1, 3, 12, -12, 250, -999 };
+    for (unsigned o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) if (!offsetIsExact(offsets[o])) failed = 1;
+    
+    printf("Seen mA  Worst hours to within 1mA  Final offsets mA  Most saves\n");
+    static const int32_t currents[] = { 0, 12, -30, 200, -500 };
+    for (unsigned c = 0; c < sizeof(currents) / sizeof(currents[0]); c++)
+    {
+        uint32_t worstMs = 0;
+        int16_t  lowMa   = INT16_MAX;
+        int16_t  highMa  = INT16_MIN;
+        uint16_t saves   = 0;
+        char     never   = 0;
+        for (int r = 0; r < RUNS; r++)
+        {
+            struct result result = run(currents[c]);
+            if (!result.msSettled) never = 1;
+            if (result.msSettled > worstMs) worstMs = result.msSettled;
+            if (result.offsetMa < lowMa ) lowMa  = result.offsetMa;
+            if (result.offsetMa > highMa) highMa = result.offsetMa;
+            if (result.saves > saves) saves = result.saves;
+        }
+        if (never) printf("%7d %26s %8d to %-6d %10d\n", currents[c], "never", lowMa, highMa, saves);
+        else       printf("%7d %26.1f %8d to %-6d %10d\n", currents[c], worstMs / 3600000.0, lowMa, highMa, saves);
+        if (never) failed = 1;
+    }
+    
+    printf(failed ? "FAIL\n" : "PASS\n");
+    return failed;
+}
\ No newline at end of file
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <setjmp.h>
+
+#include "../mstimer.h"
+
+#include "../eeprom-this.h"
+#include "../cal-pulse.h"
+#include "../count.h"
+#include "../pulse.h"
+
+/*
+Pulse adjustments
+=================
+Feeds cal-pulse.c a run of calibrations, half a day to a day and a half apart with thousands of pulses each way, whose differences come
+from fixed true errors plus noise with the sigma the module assumes, and checks:
+    the 32 bit fixed point state follows the same recursive least squares done in double to within 1% of a sigma;
+    the adjustments end within 3 sigma and half of the true errors, with a sigma under a quarter of them;
+    one calibration wrong by 20 sigma is ignored;
+    CalPulseInit reads the state back from the eeprom;
+    a calibration torn by a loss of power after a random number of byte saves leaves the state before or after it.
+*/
+#define CALIBRATIONS 60
+#define MIN_PULSES  2000 //Large so the sigma of the fit is well below the errors
+#define MAX_PULSES 30000
+#define TEARS      10000
+#define CAPACITY_AH 100
+#define POS_ERROR_MAS   700
+#define NEG_ERROR_MAS  -450
+
+extern uint8_t HostEeprom[1024];
+extern int32_t HostEepromSavesLeft;
+extern jmp_buf HostEepromPowerLost;
+
+uint16_t CountGetCapacityAh()    { return CAPACITY_AH; }
+char     TemperatureIsValid = 1;
+static int16_t _temperature8bfdp = 25 << 8;
+int16_t  TemperatureGetAs8bfdp() { return _temperature8bfdp; }
+
+static double gaussian()
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static double _e[2]    = { 0, 0 };
+static double _p[2][2] = { { 9e6, 0 }, { 0, 9e6 } };
+static double getSigmaMas(uint32_t hours)
+{
+    double dT = fabs((_temperature8bfdp - (25 << 8)) / 256.0);
+    double v  = CAPACITY_AH * 3600.0 * 5 * (1 + dT / 10);
+    double t  = 20.0 * 3600 * hours;
+    return sqrt(v * v + t * t);
+}
+static void referenceUpdate(double d, uint16_t pos, uint16_t neg, uint32_t hours)
+{
+    double p[2][2];
+    for (int i = 0; i < 2; i++) for (int j = 0; j < 2; j++) p[i][j] = _p[i][j] * 8 / 7;
+    if (p[0][0] > 9e6 || p[1][1] > 9e6) memcpy(p, _p, sizeof(p));
+    double n = (double)pos + neg;
+    double x[2] = { pos / n, -neg / n };
+    double y = d / n;
+    double sigma = getSigmaMas(hours) / n;
+    double q[2] = { p[0][0] * x[0] + p[0][1] * x[1], p[1][0] * x[0] + p[1][1] * x[1] };
+    double s = sigma * sigma + x[0] * q[0] + x[1] * q[1];
+    double innovation = y - x[0] * _e[0] - x[1] * _e[1];
+    if (fabs(innovation) > 5 * sqrt(s)) return;
+    memcpy(_p, p, sizeof(_p));
+    for (int i = 0; i < 2; i++) _e[i] += q[i] * innovation / s;
+    for (int i = 0; i < 2; i++) for (int j = 0; j < 2; j++) _p[i][j] -= q[i] * q[j] / s;
+}
+static int32_t readS32(uint16_t address)
+{
+    return (int32_t)(((uint32_t)EepromThisReadU16(address) << 16) | EepromThisReadU16(address + 2));
+}
+static uint16_t latestSlot()
+{
+    uint16_t address0 = EEPROM_CAL_PULSE_STATE;
+    uint16_t address1 = EEPROM_CAL_PULSE_STATE + 22;
+    return (int8_t)(EepromThisReadU8(address1 + 21) - EepromThisReadU8(address0 + 21)) > 0 ? address1 : address0;
+}
+static double relative(double a, double b) { return fabs(a - b) / fabs(b); }
+
+int main()
+{
+    srand(1);
+    int failed = 0;
+    memset(HostEeprom, 0xFF, sizeof(HostEeprom));
+    CalPulseInit();
+    printf("Blank eeprom gives variances %u %u\n", CalPulseGetPosVariance(), CalPulseGetNegVariance());
+    if (CalPulseGetPosVariance() != 9000000 || CalPulseGetNegVariance() != 9000000) failed = 1;
+    CalPulseSetPosAdjustMas(0);
+    CalPulseSetNegAdjustMas(0);
+    CalPulseInit();
+    
+    MsTimerCount = 1;
+    CalPulseAddCalibration(0, 0, 0); //Starts the time since the last calibration
+    double worstError = 0;
+    double worstVariance = 0;
+    for (int c = 0; c < CALIBRATIONS; c++)
+    {
+        uint32_t hours = 12 + rand() % 24;
+        MsTimerCount += hours * 3600000;
+        _temperature8bfdp = (int16_t)((15 + rand() % 15) << 8);
+        uint16_t pos = (uint16_t)(MIN_PULSES + rand() % (MAX_PULSES - MIN_PULSES));
+        uint16_t neg = (uint16_t)(MIN_PULSES + rand() % (MAX_PULSES - MIN_PULSES));
+        double   d   = (double)POS_ERROR_MAS * pos - (double)NEG_ERROR_MAS * neg + getSigmaMas(hours) * gaussian();
+        int32_t  difference = (int32_t)(d - (double)CalPulseGetPosAdjustMas() * pos + (double)CalPulseGetNegAdjustMas() * neg);
+        referenceUpdate(d, pos, neg, hours);
+        CalPulseAddCalibration(difference, pos, neg);
+        
+        double e0 = readS32(latestSlot() + 0) / 16.0;
+        double e1 = readS32(latestSlot() + 4) / 16.0;
+        if (fabs(e0 - _e[0]) > worstError) worstError = fabs(e0 - _e[0]);
+        if (fabs(e1 - _e[1]) > worstError) worstError = fabs(e1 - _e[1]);
+        if (relative(CalPulseGetPosVariance(), _p[0][0]) > worstVariance) worstVariance = relative(CalPulseGetPosVariance(), _p[0][0]);
+        if (relative(CalPulseGetNegVariance(), _p[1][1]) > worstVariance) worstVariance = relative(CalPulseGetNegVariance(), _p[1][1]);
+    }
+    double sigmaPos = sqrt(CalPulseGetPosVariance());
+    double sigmaNeg = sqrt(CalPulseGetNegVariance());
+    printf("Worst difference from double: errors %.2f mAs, variances %.3f%%\n", worstError, worstVariance * 100);
+    if (worstError > 0.01 * fmin(sigmaPos, sigmaNeg) || worstVariance > 0.01) failed = 1;
+    
+    printf("Adjustments %d %d against %d %d, sigmas %.0f %.0f\n", CalPulseGetPosAdjustMas(), CalPulseGetNegAdjustMas(), POS_ERROR_MAS, NEG_ERROR_MAS, sigmaPos, sigmaNeg);
+    if (fabs(CalPulseGetPosAdjustMas() - POS_ERROR_MAS) > 3 * sigmaPos) failed = 1;
+    if (fabs(CalPulseGetNegAdjustMas() - NEG_ERROR_MAS) > 3 * sigmaNeg) failed = 1;
+    if (fabs(CalPulseGetPosAdjustMas() - POS_ERROR_MAS) > abs(POS_ERROR_MAS) / 2 || sigmaPos > abs(POS_ERROR_MAS) / 4) failed = 1; //A wrong sign fails
+    if (fabs(CalPulseGetNegAdjustMas() - NEG_ERROR_MAS) > abs(NEG_ERROR_MAS) / 2 || sigmaNeg > abs(NEG_ERROR_MAS) / 4) failed = 1;
+    
+    int16_t  posBefore = CalPulseGetPosAdjustMas();
+    int16_t  negBefore = CalPulseGetNegAdjustMas();
+    uint32_t posVariance = CalPulseGetPosVariance();
+    uint32_t negVariance = CalPulseGetNegVariance();
+    MsTimerCount += 48 * 3600000UL;
+    CalPulseAddCalibration((int32_t)(20 * getSigmaMas(48)), 3000, 3000);
+    int stepPos = abs(CalPulseGetPosAdjustMas() - posBefore);
+    int stepNeg = abs(CalPulseGetNegAdjustMas() - negBefore);
+    printf("A calibration 20 sigma out moves the adjustments by %d %d\n", stepPos, stepNeg);
+    if (stepPos || stepNeg || CalPulseGetPosVariance() != posVariance || CalPulseGetNegVariance() != negVariance) failed = 1;
+    
+    CalPulseInit();
+    char readsBack = CalPulseGetPosVariance() == posVariance && CalPulseGetNegVariance() == negVariance;
+    printf("Init reads the state back: %d\n", readsBack);
+    if (!readsBack) failed = 1;
+    
+    uint32_t wrong = 0;
+    for (int t = 0; t < TEARS; t++)
+    {
+        uint8_t  before[1024];
+        memcpy(before, HostEeprom, sizeof(before));
+        uint32_t posBefore = CalPulseGetPosVariance();
+        uint32_t negBefore = CalPulseGetNegVariance();
+        uint16_t pos = (uint16_t)(1000 + rand() % 5000);
+        uint16_t neg = (uint16_t)(1000 + rand() % 5000);
+        int32_t  difference = (int32_t)(getSigmaMas(24) * gaussian());
+        CalPulseAddCalibration(0, 0, 0); //Restarts the time since the last calibration
+        MsTimerCount += 24 * 3600000UL;
+        CalPulseAddCalibration(difference, pos, neg);
+        uint32_t posAfter = CalPulseGetPosVariance();
+        uint32_t negAfter = CalPulseGetNegVariance();
+        
+        memcpy(HostEeprom, before, sizeof(before));
+        CalPulseInit();
+        CalPulseAddCalibration(0, 0, 0);
+        MsTimerCount += 24 * 3600000UL;
+        HostEepromSavesLeft = rand() % 32;
+        if (!setjmp(HostEepromPowerLost)) CalPulseAddCalibration(difference, pos, neg);
+        HostEepromSavesLeft = -1;
+        CalPulseInit();
+        char isBefore = CalPulseGetPosVariance() == posBefore && CalPulseGetNegVariance() == negBefore;
+        char isAfter  = CalPulseGetPosVariance() == posAfter  && CalPulseGetNegVariance() == negAfter;
+        if (!isBefore && !isAfter) wrong++;
+    }
+    printf("Torn calibrations giving neither the state before nor after: %u of %u\n", wrong, TEARS);
+    if (wrong) failed = 1;
+    
+    printf(failed ? "FAIL\n" : "PASS\n");
+    return failed;
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../cic.h"
+
+/*
+CIC decimator
+=============
+Checks cic.c against a straight reference: each output of a second order CIC at a rate of 2^n is the input through a
+triangular window 2 x 2^n - 1 samples long, worked out here by brute force in 64 bits.
+Both adc stages are covered at their widest: 12 bit samples at the fast rate and 20 bit fast values at the deepest slow
+rate, including inputs held at full scale so the integrators wrap many times over.
+*/
+#define SAMPLES 100000
+
+static uint32_t _input[SAMPLES];
+
+static uint64_t reference(uint32_t end, uint8_t log2Rate) //Output ending at sample end
+{
+    uint32_t rate = 1UL << log2Rate;
+    uint64_t total = 0;
+    for (uint32_t k = 0; k < 2 * rate - 1; k++)
+    {
+        uint32_t weight = k < rate ? k + 1 : 2 * rate - 1 - k;
+        total += (uint64_t)weight * _input[end - k];
+    }
+    return total;
+}
+static int check(const char* name, uint8_t inputBits, uint8_t log2Rate, char fullScale)
+{
+    uint32_t max = (1UL << inputBits) - 1;
+    for (uint32_t i = 0; i < SAMPLES; i++) _input[i] = fullScale ? max : (uint32_t)rand() & max;
+    
+    struct Cic cic;
+    CicReset(&cic);
+    uint32_t outputs = 0;
+    uint32_t errors  = 0;
+    for (uint32_t i = 0; i < SAMPLES; i++)
+    {
+        uint32_t output;
+        if (!CicAdd(&cic, _input[i], log2Rate, &output)) continue;
+        outputs++;
+        if (output != reference(i, log2Rate)) errors++;
+    }
+    uint32_t expected = SAMPLES / (1UL << log2Rate) - 1; //The first is discarded
+    printf("%-10s %2d bit in, rate 2^%d%s: %6lu outputs, %lu errors\n", name, inputBits, log2Rate, fullScale ? " full scale" : "           ", (unsigned long)outputs, (unsigned long)errors);
+    return errors || outputs != expected;
+}
+
+int main()
+{
+    srand(1);
+    int failed = 0;
+    for (uint8_t log2Rate = 0; log2Rate <= 8; log2Rate++) failed |= check("fast", 12, log2Rate, 0);
+    failed |= check("fast", 12, 8, 1);
+    for (uint8_t log2Rate = 2; log2Rate <= 6; log2Rate++) failed |= check("slow", 20, log2Rate, 0);
+    failed |= check("slow", 20, 6, 1);
+    
+    printf(failed ? "FAIL\n" : "PASS\n");
+    return failed;
+}
\ No newline at end of file
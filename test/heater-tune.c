@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "../temperature.c" //Included rather than linked to see its filter constants
+
+#include "../heater.h"
+#include "../heater-tune.h"
+
+/*
+Heater auto tune
+================
+Runs the relay auto tune against a first order plus dead time thermal plant: the heater at full power raises the box
+FULL_POWER_RISE above ambient with a time constant of TAU_S, seen DEAD_MS later. The sensor is an ADT7410 read every
+250ms through temperature.c, with one lsb of noise, so the tune sees the real boxcar and exponential filter.
+The period and gain are compared with the analytic values for the plant plus the filter:
+    phase at the ultimate frequency w = atan(w TAU_S) + w (dead time + boxcar delay) + atan(w filter time constant) = pi
+    Ku = sqrt(1 + (w TAU_S)^2) x sqrt(1 + (w filter time constant)^2) / gain
+The relay method is an approximation so Kp is expected within about 25%.
+*/
+#define TAU_S           3600.0
+#define DEAD_MS       300000
+#define FULL_POWER_RISE   22.0 //Degrees above ambient with the heater fully on
+#define AMBIENT_C          5.0
+#define SET_POINT_C       15.0
+#define STEP_MS SAMPLE_INTERVAL_MS
+
+static uint16_t _kp = 0;
+static uint16_t _ki = 0;
+void HeaterSetKp8bfdp(uint16_t v) { _kp = v; }
+void HeaterSetKi8bfdp(uint16_t v) { _ki = v; }
+
+static double _temperatureC = AMBIENT_C;
+char I2CThisSubmit(struct I2CThisTransaction* p) //The ADT7410 answers at once
+{
+    if (p->receiveLength)
+    {
+        int16_t raw = (int16_t)lround(_temperatureC * 128) + rand() % 3 - 1; //16 bit mode is 7bfdp
+        p->pReceive[0] = (uint8_t)((uint16_t)raw >> 8);
+        p->pReceive[1] = (uint8_t)raw;
+    }
+    p->status = I2C_THIS_DONE;
+    return 1;
+}
+
+int main()
+{
+    srand(1);
+    int failed = 0;
+    
+    static uint8_t history[DEAD_MS / STEP_MS];
+    uint8_t power = 0;
+    double gain = FULL_POWER_RISE / 255;
+    
+    HeaterTuneStart();
+    for (uint32_t step = 0; HeaterTuneGetIsRunning(); step++)
+    {
+        MsTimerCount += STEP_MS;
+        uint8_t seen = history[step % (DEAD_MS / STEP_MS)];
+        history[step % (DEAD_MS / STEP_MS)] = power;
+        _temperatureC += (gain * seen - (_temperatureC - AMBIENT_C)) * (STEP_MS / 1000.0) / TAU_S;
+        
+        TemperatureMain();
+        if (!TemperatureSampleIsReadyForUseByHeater) continue;
+        TemperatureSampleIsReadyForUseByHeater = 0;
+        power = HeaterTuneAddSample((int16_t)(SET_POINT_C * 256), TemperatureGetAs8bfdp());
+    }
+    
+    double filterS = (STEP_MS / 1000.0) * (1 << EMA_SHIFT);
+    double delayS  = DEAD_MS / 1000.0 + (STEP_MS / 1000.0) * BOXCAR_SIZE / 2;
+    double low = 1e-6, high = 1;
+    for (int i = 0; i < 200; i++)
+    {
+        double w = (low + high) / 2;
+        if (atan(w * TAU_S) + w * delayS + atan(w * filterS) < M_PI) low = w; else high = w;
+    }
+    double w  = low;
+    double ku = sqrt(1 + w * TAU_S * w * TAU_S) * sqrt(1 + w * filterS * w * filterS) / gain; //Output per degree
+    double tuMins = 2 * M_PI / w / 60;
+    double kp8bfdp = 0.45 * ku * 256; //Output out of 256 per degree, 8bfdp
+    
+    printf("State %c after %.1f hours\n", HeaterTuneGetState(), MsTimerCount / 3600000.0);
+    printf("Tu  %5u mins against %5.0f analytic\n", HeaterTuneGetPeriodMins(), tuMins);
+    printf("Kp  %5u      against %5.0f analytic\n", _kp, kp8bfdp);
+    printf("Ki  %5u\n", _ki);
+    if (HeaterTuneGetState() != HEATER_TUNE_DONE)                     failed = 1;
+    if (fabs(HeaterTuneGetPeriodMins() - tuMins) > 0.15 * tuMins)      failed = 1;
+    if (fabs(_kp - kp8bfdp) > 0.25 * kp8bfdp)                           failed = 1;
+    
+    printf(failed ? "FAIL\n" : "PASS\n");
+    return failed;
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include "../eeprom-this.h"
+#include "../journal.h"
+
+/*
+Journal
+=======
+Runs the journal against a ram backed eeprom:
+    a blank eeprom, all 0xFF, gives no record;
+    100,000 saves of a wandering charge, reading back through a fresh JournalInit every 1000;
+    10,000 saves each torn by a loss of power after a random number of bytes, which must give the previous record;
+then reports the wear as the most writes to any byte against the 2084 expected from 100,000 / 48 x bytes changed.
+*/
+#define SAVES 100000
+#define TEARS  10000
+
+extern uint8_t  HostEeprom[1024];
+extern uint32_t HostEepromWrites[1024];
+extern int32_t  HostEepromSavesLeft;
+extern jmp_buf  HostEepromPowerLost;
+
+#define RECORD_SAVES (1 + sizeof(struct JournalRecord) + 1)
+
+static struct JournalRecord _record;
+static void wander()
+{
+    _record.milliAmpSeconds += (uint32_t)(rand() % 20001) - 10000;
+    if (rand() % 8 == 0) _record.posPulses++;
+    if (rand() % 8 == 0) _record.negPulses++;
+}
+static char readsBack(const struct JournalRecord* pExpected)
+{
+    struct JournalRecord record;
+    JournalInit();
+    if (!JournalRead(&record)) return 0;
+    return !memcmp(&record, pExpected, sizeof(record));
+}
+
+int main()
+{
+    srand(1);
+    int failed = 0;
+    
+    memset(HostEeprom, 0xFF, sizeof(HostEeprom));
+    struct JournalRecord record;
+    JournalInit();
+    char blankHasRecord = JournalRead(&record);
+    printf("Blank eeprom gives a record: %d\n", blankHasRecord);
+    if (blankHasRecord) failed = 1;
+    
+    uint32_t mismatches = 0;
+    for (uint32_t i = 1; i <= SAVES; i++)
+    {
+        wander();
+        JournalWrite(&_record);
+        if (i % 1000 == 0 && !readsBack(&_record)) mismatches++;
+    }
+    printf("Saves %d, read back mismatches %lu\n", SAVES, (unsigned long)mismatches);
+    if (mismatches) failed = 1;
+    
+    uint32_t most = 0;
+    for (uint16_t a = EEPROM_JOURNAL_START; a < EEPROM_JOURNAL_START + EEPROM_JOURNAL_RECORD_COUNT * RECORD_SAVES; a++) if (HostEepromWrites[a] > most) most = HostEepromWrites[a];
+    printf("Most writes to a byte %lu, limit %d\n", (unsigned long)most, (SAVES + EEPROM_JOURNAL_RECORD_COUNT - 1) / EEPROM_JOURNAL_RECORD_COUNT);
+    if (most > (SAVES + EEPROM_JOURNAL_RECORD_COUNT - 1) / EEPROM_JOURNAL_RECORD_COUNT) failed = 1;
+    
+    uint32_t wrong = 0;
+    for (uint32_t i = 0; i < TEARS; i++)
+    {
+        struct JournalRecord previous = _record;
+        wander();
+        HostEepromSavesLeft = rand() % RECORD_SAVES; //The sequence, the last save, is never made
+        if (!setjmp(HostEepromPowerLost)) JournalWrite(&_record);
+        HostEepromSavesLeft = -1;
+        if (!readsBack(&previous)) wrong++;
+        _record = previous;
+    }
+    printf("Torn saves %d, wrong after recovery %lu\n", TEARS, (unsigned long)wrong);
+    if (wrong) failed = 1;
+    
+    printf(failed ? "FAIL\n" : "PASS\n");
+    return failed;
+}
\ No newline at end of file
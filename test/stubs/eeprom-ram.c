@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include <setjmp.h>
+
+#include "../../eeprom-this.h"
+
+/*
+Ram backed stand in for eeprom-this.c: saves go straight to the array, a byte which already holds its value is not
+written, and the writes to each byte are counted for the wear.
+Setting HostEepromSavesLeft makes the save after that many longjmp to HostEepromPowerLost, as if the power went.
+*/
+uint8_t  HostEeprom[1024];
+uint32_t HostEepromWrites[1024];
+int32_t  HostEepromSavesLeft = -1; //Negative for never
+jmp_buf  HostEepromPowerLost;
+
+void EepromThisSaveU8(uint16_t address, uint8_t value)
+{
+    if (HostEepromSavesLeft == 0) longjmp(HostEepromPowerLost, 1);
+    if (HostEepromSavesLeft >  0) HostEepromSavesLeft--;
+    if (HostEeprom[address] == value) return;
+    HostEeprom[address] = value;
+    HostEepromWrites[address]++;
+}
+uint8_t EepromThisReadU8(uint16_t address)
+{
+    return HostEeprom[address];
+}
+
+void     EepromThisSaveS8  (uint16_t address,  int8_t  value) { EepromThisSaveU8(address, (uint8_t)value); }
+void     EepromThisSaveChar(uint16_t address,    char  value) { EepromThisSaveU8(address, (uint8_t)value); }
+void     EepromThisSaveU16 (uint16_t address, uint16_t value) { EepromThisSaveU8(address, (uint8_t)value); EepromThisSaveU8(address + 1, (uint8_t)(value >> 8)); }
+void     EepromThisSaveS16 (uint16_t address,  int16_t value) { EepromThisSaveU16(address, (uint16_t)value); }
+int8_t   EepromThisReadS8  (uint16_t address) { return (int8_t)EepromThisReadU8(address); }
+char     EepromThisReadChar(uint16_t address) { return (char  )EepromThisReadU8(address); }
+uint16_t EepromThisReadU16 (uint16_t address) { return EepromThisReadU8(address) | ((uint16_t)EepromThisReadU8(address + 1) << 8); }
+int16_t  EepromThisReadS16 (uint16_t address) { return (int16_t)EepromThisReadU16(address); }
+void     EepromThisFlush   (void) {}
+void     EepromThisWaitForWrite(void) {}
\ No newline at end of file
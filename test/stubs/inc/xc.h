@@ -0,0 +1,14 @@
+#include <stdint.h>
+
+//Host stand in for the XC8 device header: each register is a plain variable so a harness can play the hardware
+
+struct hostBits
+{
+    unsigned CHS:8, CHSN:8, ADFM:8, ACQT:8, ADCS:8, VCFG:8, VNCFG:8, TRIGSEL:8, ADON:8;
+    unsigned TMR3CS:8, T3CKPS:8, TMR3ON:8, C2TSEL:8, CCP2M:8;
+};
+extern volatile struct hostBits ADCON0bits, ADCON1bits, ADCON2bits, T3CONbits, CCPTMRSbits, CCP2CONbits;
+extern volatile unsigned char ADRESH, ADRESL, ANCON0, ANCON1, ADIF, ADIE, CCPR2H, CCPR2L, TMR3H, TMR3L, TMR3IF, CCP2IF, CCP2IE;
+
+#define di()
+#define ei()
\ No newline at end of file
@@ -0,0 +1,13 @@
+#include <stdint.h>
+
+#include "../mstimer.h"
+
+uint32_t MsTimerCount = 0;
+
+char MsTimerRelative(uint32_t base, uint32_t ms) { return MsTimerCount - base >= ms; }
+char MsTimerRepetitive(uint32_t* pBase, uint32_t ms)
+{
+    if (MsTimerCount - *pBase < ms) return 0;
+    *pBase += ms;
+    return 1;
+}
\ No newline at end of file
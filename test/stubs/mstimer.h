@@ -0,0 +1,8 @@
+#include <stdint.h>
+
+//Host stand in for the shared ms timer: the harness advances MsTimerCount itself
+
+extern uint32_t MsTimerCount;
+
+extern char MsTimerRelative(uint32_t base, uint32_t ms);
+extern char MsTimerRepetitive(uint32_t* pBase, uint32_t ms);
\ No newline at end of file
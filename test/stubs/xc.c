@@ -0,0 +1,4 @@
+#include <xc.h>
+
+volatile struct hostBits ADCON0bits, ADCON1bits, ADCON2bits, T3CONbits, CCPTMRSbits, CCP2CONbits;
+volatile unsigned char ADRESH, ADRESL, ANCON0, ANCON1, ADIF, ADIE, CCPR2H, CCPR2L, TMR3H, TMR3L, TMR3IF, CCP2IF, CCP2IE;
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "../mstimer.h"
+
+#include "../temperature.c" //Included rather than linked to see its filter constants
+
+/*
+Temperature filter
+==================
+Feeds temperature.c, through a stand in for the i2c queue, with a steady 20 degrees plus the ADT7410's behaviour: a slow
+wander of a few lsbs over seconds and an lsb of white noise, in 7bfdp. Compares the filter with the old average of
+256 samples a minute:
+    the standard deviation of each output over a steady day, in 1/256 degree;
+    the mean time each takes to reach 90% of a 1 degree step, over a day of steps up and down every 20 minutes which
+    fall at every point of the old minute.
+The filter must be no noisier than the old average and must settle faster on average.
+*/
+#define HOURS         48
+#define STEADY_HOURS  24
+#define STEP_MS       (20 * 60000UL + 1750) //Not a whole number of minutes so the steps move through the old minute
+
+static double gaussian()
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static int16_t _raw7bfdp = 0;
+char I2CThisSubmit(struct I2CThisTransaction* p) //The ADT7410 answers at once
+{
+    if (p->receiveLength)
+    {
+        p->pReceive[0] = (uint8_t)((uint16_t)_raw7bfdp >> 8);
+        p->pReceive[1] = (uint8_t)_raw7bfdp;
+    }
+    p->status = I2C_THIS_DONE;
+    return 1;
+}
+
+struct stats { double total; double squares; uint32_t count; };
+static void addStat(struct stats* p, double v) { p->total += v; p->squares += v * v; p->count++; }
+static double sd(struct stats* p) { double mean = p->total / p->count; return sqrt(p->squares / p->count - mean * mean); }
+
+int main()
+{
+    srand(1);
+    int failed = 0;
+    
+    double wander = 0;
+    int32_t oldTotal = 0;
+    int16_t oldCount = 0;
+    int16_t old8bfdp = 0;
+    struct stats newStats = { 0 };
+    struct stats oldStats = { 0 };
+    struct stats newSettle = { 0 };
+    struct stats oldSettle = { 0 };
+    uint32_t msSteady = STEADY_HOURS * 3600000UL;
+    uint32_t msStep = 0;
+    char     up = 0;
+    char     newSettled = 1;
+    char     oldSettled = 1;
+    
+    while (MsTimerCount < HOURS * 3600000UL)
+    {
+        MsTimerCount += SAMPLE_INTERVAL_MS;
+        if (MsTimerCount > msSteady && MsTimerCount - msSteady >= msStep + STEP_MS)
+        {
+            msStep = MsTimerCount - msSteady;
+            up = !up;
+            newSettled = 0;
+            oldSettled = 0;
+        }
+        wander += gaussian() * 0.5;
+        wander *= 0.98;
+        double degrees = up ? 21 : 20;
+        _raw7bfdp = (int16_t)lround(degrees * 128 + wander + gaussian());
+        
+        TemperatureMain();
+        if (!TemperatureSampleIsReadyForUseByHeater) continue;
+        TemperatureSampleIsReadyForUseByHeater = 0;
+        
+        oldTotal += _raw7bfdp;
+        if (++oldCount == 256)
+        {
+            old8bfdp = (int16_t)(oldTotal >> 7);
+            oldTotal = 0;
+            oldCount = 0;
+            if (MsTimerCount > 3600000 && MsTimerCount < msSteady) addStat(&oldStats, old8bfdp);
+        }
+        if (MsTimerCount > 3600000 && MsTimerCount < msSteady) addStat(&newStats, TemperatureGetAs8bfdp());
+        
+        int16_t settled8bfdp = up ? 21 * 256 - 256 / 10 : 20 * 256 + 256 / 10; //90% of the step
+        double  msSinceStep  = MsTimerCount - msSteady - msStep;
+        int16_t new8bfdp     = TemperatureGetAs8bfdp();
+        if (!newSettled && (up ? new8bfdp >= settled8bfdp : new8bfdp <= settled8bfdp)) { newSettled = 1; addStat(&newSettle, msSinceStep / 1000); }
+        if (!oldSettled && (up ? old8bfdp >= settled8bfdp : old8bfdp <= settled8bfdp)) { oldSettled = 1; addStat(&oldSettle, msSinceStep / 1000); }
+    }
+    double newSettleS = newSettle.total / newSettle.count;
+    double oldSettleS = oldSettle.total / oldSettle.count;
+    
+    printf("                  Filter  Old average\n");
+    printf("SD 1/256 degree %8.2f %12.2f\n", sd(&newStats), sd(&oldStats));
+    printf("90%% of step s   %8.1f %12.1f  mean of %lu steps\n", newSettleS, oldSettleS, (unsigned long)newSettle.count);
+    printf("Noise estimate  %8d 1/256 degree\n", TemperatureGetNoise8bfdp());
+    if (sd(&newStats) > sd(&oldStats))                  failed = 1;
+    if (newSettleS >= oldSettleS)                       failed = 1;
+    
+    printf(failed ? "FAIL\n" : "PASS\n");
+    return failed;
+}
\ No newline at end of file
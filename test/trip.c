@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <xc.h>
+
+#include "../mstimer.h"
+
+#include "../adc.h"
+#include "../output.h"
+
+/*
+Trip latency
+============
+Plays the adc interrupt at 1000 samples per second with a battery voltage ramping through the high limit, plus noise,
+and reports when the output was tripped relative to the true voltage crossing the limit, and the latency the adc measured.
+Noise can trip it a little early: it must not trip before the true voltage is within the noise of the limit and must trip
+within ADC_TRIP_SAMPLES of it being beyond the noise.
+Built with ADC_CHANNEL_COUNT 2 the battery conversions alternate with those of a second channel, which must not change
+any of the trip figures, and the second channel must read back its counts in ADC_CHANNEL_BITS.
+Then holds the voltage one count inside each limit for half a day, so the noise takes single samples beyond it, and checks
+the output is tripped exactly when ADC_TRIP_SAMPLES samples in a row are beyond it.
+*/
+#define HIGH_LIMIT 3500
+#define LOW_LIMIT  2500
+#define NOISE       2 //Counts either way
+
+#define BATTERY_AN     1
+#define SCANNED_AN     9    //Second entry in the adc table when built with ADC_CHANNEL_COUNT 2
+#define SCANNED_COUNTS 1234
+
+static uint32_t _msTripped = 0;
+static char     _fault     = 0;
+void OutputHandleVoltageTrip(char fault)
+{
+    if (_fault) return;
+    _fault = fault;
+    _msTripped = MsTimerCount;
+}
+
+static int noise()
+{
+    return rand() % (2 * NOISE + 1) - NOISE;
+}
+static void convert(int32_t counts)
+{
+    ADRESH = (uint8_t)(counts >> 8);
+    ADRESL = (uint8_t)counts;
+    ADIF = 1;
+    if (AdcHadInterrupt()) AdcHandleInterrupt();
+}
+static uint32_t _wrongChannels = 0; //Conversions not of the channel the scan should have selected
+static void sample(int32_t counts)
+{
+    if (counts < 0) counts = 0;
+    if (counts > 4095) counts = 4095;
+    MsTimerCount++;
+    if (ADCON0bits.CHS != BATTERY_AN) _wrongChannels++;
+    convert(counts);
+#if ADC_CHANNEL_COUNT > 1
+    if (ADCON0bits.CHS != SCANNED_AN) _wrongChannels++;
+    convert(SCANNED_COUNTS);
+#endif
+}
+static int32_t msToReach(int32_t start, int32_t rate, int32_t counts) //First sample with the true voltage at or beyond counts
+{
+    int32_t ms = (int32_t)(((int64_t)(counts - start) * 1000 + rate - 1) / rate);
+    return ms < 1 ? 1 : ms;
+}
+static void reset()
+{
+    _fault = 0;
+    AdcSetTripLimits(HIGH_LIMIT, LOW_LIMIT);
+    for (int i = 0; i < 100; i++) sample(3000 + noise());
+}
+
+int main()
+{
+    srand(1);
+    AdcInit();
+    int failed = 0;
+    
+    printf("Ramp counts/s  Trip ms after crossing  Adc latency ms\n");
+    static const int32_t rates[] = { 1, 10, 100, 1000, 10000, 100000 };
+    for (unsigned r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+    {
+        reset();
+        int32_t  start = HIGH_LIMIT - 20;
+        uint32_t msStart   = MsTimerCount;
+        int32_t  msNear    = msToReach(start, rates[r], HIGH_LIMIT - NOISE + 1); //True voltage within the noise of the limit
+        int32_t  msCrossed = msToReach(start, rates[r], HIGH_LIMIT + 1);         //True voltage beyond the limit
+        int32_t  msBeyond  = msToReach(start, rates[r], HIGH_LIMIT + NOISE + 1); //True voltage beyond the noise
+        while (!_fault)
+        {
+            int32_t counts = start + (int32_t)((int64_t)rates[r] * (MsTimerCount + 1 - msStart) / 1000);
+            sample(counts + noise());
+        }
+        int32_t msTripped = (int32_t)(_msTripped - msStart);
+        printf("%13d %23d %15lu\n", rates[r], msTripped - msCrossed, (unsigned long)AdcGetTripLatencyMs());
+        if (_fault != OUTPUT_FAULT_OVER_VOLTAGE)             failed = 1;
+        if (msTripped < msNear   + ADC_TRIP_SAMPLES - 1)     failed = 1;
+        if (msTripped > msBeyond + ADC_TRIP_SAMPLES - 1)     failed = 1;
+    }
+    
+    reset();
+    uint32_t crossings  = 0;
+    uint32_t trips      = 0;
+    uint32_t wrongTrips = 0; //Tripped without ADC_TRIP_SAMPLES samples in a row beyond a limit, or not tripped with them
+    int      run        = 0;
+    for (uint32_t ms = 0; ms < 24UL * 3600 * 1000; ms++)
+    {
+        char    high   = ms < 12UL * 3600 * 1000;
+        int32_t counts = high ? HIGH_LIMIT - 1 + noise() : LOW_LIMIT + 1 + noise(); //Noise takes it beyond the limit
+        char    beyond = high ? counts > HIGH_LIMIT : counts < LOW_LIMIT;
+        if (beyond) { crossings++; run++; } else run = 0;
+        sample(counts);
+        if ((_fault != 0) != (run == ADC_TRIP_SAMPLES)) wrongTrips++;
+        if (_fault) { trips++; _fault = 0; }
+    }
+    printf("Noise crossings in a day %lu, runs of %d tripping %lu, wrong trips %lu\n", (unsigned long)crossings, ADC_TRIP_SAMPLES, (unsigned long)trips, (unsigned long)wrongTrips);
+    if (crossings == 0 || wrongTrips) failed = 1;
+    
+#if ADC_CHANNEL_COUNT > 1
+    int16_t expected = SCANNED_COUNTS << (ADC_CHANNEL_BITS - 12);
+    printf("Scanned channel valid %d, value %d against %d\n", AdcChannelIsValid(1), AdcGetChannelValue(1), expected);
+    if (!AdcChannelIsValid(1) || AdcGetChannelValue(1) != expected) failed = 1;
+#endif
+    printf("Conversions of the wrong channel %lu\n", (unsigned long)_wrongChannels);
+    if (_wrongChannels) failed = 1;
+    
+    printf(failed ? "FAIL\n" : "PASS\n");
+    return failed;
+}
\ No newline at end of file
@@ -1,15 +1,156 @@
 #include <stdint.h>
 
+#include "../mstimer.h"
+
 #include "voltage.h"
 #include "adc.h"
+#include "output.h"
+#include "pulse.h"
+#include "rest.h"
+#include "ocv.h"
+#include "eeprom-this.h"
+
+/*
+Battery mV = adc x multiplier / 2^18 + offset
+The default multiplier is ADC_VREF_MV x divisor x 4 = 4096 x 2.0364 x 4 = 33364 and the default offset is 8199mV.
+The values are kept with 4 extra bits (mv4bfdp) and only worked out when the adc produces a new value.
+
+Two point calibration: send the battery voltage measured externally once when low and once when high.
+Each records the current slow adc value and, once both are known, the multiplier and offset are recalculated and saved.
+*/
+#define DEFAULT_MULTIPLIER 33364
+#define DEFAULT_OFFSET_MV   8199
+#define MULTIPLIER_SHIFT      18
+
+#define CURRENT_CHANGE_MA           500
+#define CURRENT_CHANGE_HOLD_MS 60UL * 1000
+
+static uint16_t _multiplier = 0;
+static  int16_t _offsetMv   = 0;
 
-#define MV_SUBTRACTED 8199
-#define VOLTAGE_DIVISOR_4DP  20364
+static uint8_t  _fastCount      = 0;
+static uint8_t  _slowCount      = 0;
+static uint16_t _slowAdc        = 0;
+static  int16_t _fastMv         = 0;
+static  int32_t _slowMv4bfdp    = 0;
+static  int16_t _slowMv         = 0;
+static uint8_t  _slowBits       = 0;
+static uint16_t _version        = 0;
 
-int16_t VoltageGetAsMv()
+static  int16_t _tripHighMv = 0;
+static  int16_t _tripLowMv  = 0;
+
+static uint16_t _calLowAdc  = 0; static int16_t _calLowMv  = 0;
+static uint16_t _calHighAdc = 0; static int16_t _calHighMv = 0;
+
+static int32_t convert4bfdp(uint16_t adcValue)
+{
+    return (int32_t)(((uint32_t)adcValue * _multiplier) >> (MULTIPLIER_SHIFT - 4)) + (int32_t)_offsetMv * 16;
+}
+static uint32_t convertMvToAdc(int16_t mv) //Inverse of convert4bfdp on the 16 bit adc scale; may be beyond 16 bits
+{
+    int32_t aboveOffset = (int32_t)mv - _offsetMv;
+    if (aboveOffset <= 0) return 0;
+    uint32_t shifted = (uint32_t)aboveOffset << (MULTIPLIER_SHIFT - 16); //Shifting by all 18 would overflow from 16384mV
+    uint32_t whole   = shifted / _multiplier;
+    uint32_t rest    = shifted % _multiplier;                             //Below 2^16 so the remainder can take the other 16
+    return (whole << 16) + (rest << 16) / _multiplier;
+}
+static void setTripLimits() //The adc compares its raw 12 bit samples so works out the limits whenever they or the calibration change
+{
+    uint32_t high = convertMvToAdc(_tripHighMv) >> (ADC_BITS - 12);
+    uint32_t low  = convertMvToAdc(_tripLowMv ) >> (ADC_BITS - 12);
+    if (!_tripHighMv || high > 0xFFFF) high = 0xFFFF; //Never trip
+    if (!_tripLowMv                  ) low  = 0;      //Never trip
+    if (low > 0xFFFF) low = 0xFFFF;
+    AdcSetTripLimits((uint16_t)high, (uint16_t)low);
+}
+void VoltageSetTripLimitsMv(int16_t highMv, int16_t lowMv)
+{
+    _tripHighMv = highMv;
+    _tripLowMv  = lowMv;
+    setTripLimits();
+}
+static void recalculate()
+{
+    struct AdcBattery battery;
+    AdcGetBattery(&battery);
+    if (battery.fastCount != _fastCount)
+    {
+        _fastCount = battery.fastCount;
+        _fastMv = (int16_t)(convert4bfdp(battery.fastValue) >> 4);
+    }
+    if (battery.slowCount != _slowCount)
+    {
+        _slowCount   = battery.slowCount;
+        _slowAdc     = battery.slowValue;
+        _slowBits    = battery.slowBits;
+        _slowMv4bfdp = convert4bfdp(battery.slowValue);
+        _slowMv      = (int16_t)(_slowMv4bfdp >> 4);
+        _version++;
+    }
+}
+
+int16_t  VoltageGetAsMv           () { return AdcSlowValueIsValid ? _slowMv      : 0; } //Slow high resolution value for calibration and display
+int32_t  VoltageGetAsMv4bfdp      () { return AdcSlowValueIsValid ? _slowMv4bfdp : 0; }
+int16_t  VoltageGetFastAsMv       () { return AdcFastValueIsValid ? _fastMv      : 0; } //Fast value for control
+uint8_t  VoltageGetResolutionBits () { return _slowBits; }                              //Effective resolution of the slow value
+uint16_t VoltageGetVersion        () { return _version;  }                              //Incremented with each new slow value
+
+uint16_t VoltageGetMultiplier     () { return _multiplier; }
+int16_t  VoltageGetOffsetMv       () { return _offsetMv;   }
+static void setCalibration(uint16_t multiplier, int16_t offsetMv)
+{
+    _multiplier = multiplier;
+    _offsetMv   = offsetMv;
+    EepromThisSaveU16(EEPROM_VOLTAGE_MULTIPLIER_U16, _multiplier);
+    EepromThisSaveS16(EEPROM_VOLTAGE_OFFSET_MV_S16 , _offsetMv  );
+    _fastCount--; //Force the cached values to be worked out again
+    _slowCount--;
+    recalculate();
+    setTripLimits();
+}
+void VoltageSetMultiplier(uint16_t v) { setCalibration(v, _offsetMv); }
+void VoltageSetOffsetMv  ( int16_t v) { setCalibration(_multiplier, v); }
+
+static void calibrateFromPoints()
+{
+    if (!_calLowAdc || !_calHighAdc) return;
+    if (_calHighAdc <= _calLowAdc || _calHighMv <= _calLowMv) return;
+    uint32_t multiplier = ((uint32_t)(_calHighMv - _calLowMv) << MULTIPLIER_SHIFT) / (_calHighAdc - _calLowAdc);
+    if (multiplier > 0xFFFF) return;
+    int16_t offsetMv = _calLowMv - (int16_t)(((uint32_t)_calLowAdc * multiplier) >> MULTIPLIER_SHIFT);
+    setCalibration((uint16_t)multiplier, offsetMv);
+}
+void VoltageCalibrateLowMv (int16_t mv) { if (!AdcSlowValueIsValid) return; _calLowAdc  = _slowAdc; _calLowMv  = mv; calibrateFromPoints(); }
+void VoltageCalibrateHighMv(int16_t mv) { if (!AdcSlowValueIsValid) return; _calHighAdc = _slowAdc; _calHighMv = mv; calibrateFromPoints(); }
+
+void VoltageInit()
+{
+    _multiplier = EepromThisReadU16(EEPROM_VOLTAGE_MULTIPLIER_U16);
+    _offsetMv   = EepromThisReadS16(EEPROM_VOLTAGE_OFFSET_MV_S16 );
+    if (_multiplier == 0 || _multiplier == 0xFFFF) //Eeprom value is likely not initialised
+    {
+        _multiplier = DEFAULT_MULTIPLIER;
+        _offsetMv   = DEFAULT_OFFSET_MV;
+    }
+}
+void VoltageMain()
 {
-    if (!AdcValueIsValid) return 0;
-    int32_t adcMv = (ADC_VREF_MV * (int32_t)AdcGetValue()) >> ADC_BITS;
-    int32_t batteryVoltage = (adcMv * VOLTAGE_DIVISOR_4DP) / 10000 + MV_SUBTRACTED;
-    return (int16_t)batteryVoltage;
+    recalculate();
+    
+    //Note when the current last changed significantly
+    static int32_t  lastMa = 0;
+    static uint32_t msTimerCurrentChanged = 0;
+    int32_t ma = PulseGetCurrentMa();
+    int32_t change = ma - lastMa;
+    if (change < 0) change = -change;
+    if (change > CURRENT_CHANGE_MA) msTimerCurrentChanged = MsTimerCount;
+    lastMa = ma;
+    char currentIsChanging = !MsTimerRelative(msTimerCurrentChanged, CURRENT_CHANGE_HOLD_MS);
+    
+    //Follow the battery quickly while it is working; resolve it finely once it is resting
+    char state = OutputGetState();
+    if      (state == 'C' || state == 'D' || currentIsChanging) AdcSetSlowLog2Rate(ADC_SLOW_LOG2_RATE_SHALLOW);
+    else if (RestGetIsAtRest() || OcvGetIsConfident())            AdcSetSlowLog2Rate(ADC_SLOW_LOG2_RATE_DEEP   );
 }
\ No newline at end of file
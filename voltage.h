@@ -1,2 +1,16 @@
+#include <stdint.h>
 
-extern int16_t VoltageGetAsMv(void);
\ No newline at end of file
+extern int16_t  VoltageGetAsMv(void);
+extern int32_t  VoltageGetAsMv4bfdp(void);
+extern int16_t  VoltageGetFastAsMv(void);
+extern uint8_t  VoltageGetResolutionBits(void);
+extern uint16_t VoltageGetVersion(void);
+
+extern uint16_t VoltageGetMultiplier(void); extern void VoltageSetMultiplier(uint16_t);
+extern  int16_t VoltageGetOffsetMv  (void); extern void VoltageSetOffsetMv  ( int16_t);
+extern void     VoltageCalibrateLowMv (int16_t mv);
+extern void     VoltageCalibrateHighMv(int16_t mv);
+extern void     VoltageSetTripLimitsMv(int16_t highMv, int16_t lowMv); //Zero for no limit
+
+extern void     VoltageInit(void);
+extern void     VoltageMain(void);
\ No newline at end of file